@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+
+for THREAD in 4 16 64; do
+    make -C $(dirname $0) THREAD_NUM=$THREAD
+    $(dirname $0)/test
+    make -C $(dirname $0) latency THREAD_NUM=$THREAD
+    $(dirname $0)/test
+    echo "-------------------------"
+done
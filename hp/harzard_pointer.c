@@ -25,40 +25,263 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <threads.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+
+#include "harzard_pointer.h"
 
 #define HP_MAX_THREAD_RL 128
 #define HP_MAX_PTR 4
+#define HP_MAX_HAZARD (HP_MAX_THREAD_RL * HP_MAX_PTR)
 #define COHERENCE_PAD 128
 #define HP_TID_UNINIT -1
 
+/* The retire list is a chain of cache-aligned chunks, it grows by linking
+ * a new chunk in front and never copies the retired pointers.
+ */
+#define HP_RL_CHUNK_SIZE 1024
+#define HP_RL_CHUNK_NR \
+    ((HP_RL_CHUNK_SIZE - sizeof(void *) - sizeof(size_t)) / sizeof(uintptr_t))
+/* Default depth of a retire list to trigger the back-pressure. */
+#define HP_RL_LIMIT (8 * HP_MAX_HAZARD)
+/* How often the reclaimer rescans the still protected pointers. */
+#define HP_RECLAIM_PERIOD_NS 1000000
+
+struct hp_rl_chunk {
+    struct hp_rl_chunk *next;
+    size_t size;
+    uintptr_t list[HP_RL_CHUNK_NR];
+};
+
+_Static_assert(sizeof(struct hp_rl_chunk) <= HP_RL_CHUNK_SIZE,
+               "hp_rl_chunk is larger than HP_RL_CHUNK_SIZE");
+
 typedef struct {
     size_t size;
-    uintptr_t *list;
+    size_t next_scan;
+    struct hp_rl_chunk *head; /* the newest chunk, where to append */
+    struct hp_rl_chunk *spare;
 } retirelist_t;
 
 typedef struct {
     alignas(COHERENCE_PAD / 2) atomic_uintptr_t hp[HP_MAX_PTR];
     alignas(COHERENCE_PAD / 2) retirelist_t rl;
+    atomic_size_t peak;
+    struct hp_rl_chunk *async; /* the batch for the reclaimer */
+    atomic_int async_pin; /* using the reclaimer, see __hp_async_get() */
 } th_info_t;
 
+/* The asynchronous reclaimer. The writers push full batches (chunks) to
+ * a lock-free MPSC stack and the reclaimer takes them all at once, so
+ * there is no ABA problem. The flush requests are sequence numbers, the
+ * reclaimer publishes the last one it has finished.
+ */
+struct hp_reclaimer {
+    struct hp_struct *hp;
+    pthread_t thread;
+    _Atomic(struct hp_rl_chunk *) queue;
+    bool stop;
+    uint64_t request, done;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, idle;
+};
+
+/* The retire list left by an unregistered thread */
+struct hp_orphan {
+    struct hp_orphan *next;
+    retirelist_t rl;
+};
+
 typedef struct hp_struct {
-    th_info_t thread_info[HP_MAX_THREAD_RL];
+    alignas(COHERENCE_PAD) th_info_t thread_info[HP_MAX_THREAD_RL];
     void (*delete_func)(void *);
+    int scan_mode;
+    size_t scan_threshold;
+    int bp_policy;
+    size_t bp_limit;
+    atomic_size_t nr_backpressure;
+    _Atomic(struct hp_reclaimer *) reclaimer;
+    _Atomic(struct hp_orphan *) orphans;
+    atomic_int refs; /* the unregistering threads handing off to it */
+    struct hp_struct *next;
 } hp_t;
 
+/* Thread slots are shared by all the hp_t. The free slots are kept in a
+ * lock-free stack whose head packs an ABA tag (high 32 bits) with the slot
+ * index plus one (low 32 bits, 0 means empty). Slots beyond the high-water
+ * mark have never been used, so the scans only need to walk [0, hwm).
+ */
 static thread_local int tid = HP_TID_UNINIT;
-static atomic_int_fast32_t __tid = ATOMIC_VAR_INIT(HP_TID_UNINIT);
+static atomic_int_fast32_t __tid_hwm = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t __tid_free = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast32_t __tid_free_next[HP_MAX_THREAD_RL];
+
+/* With the membarrier, the readers only need the compiler barrier and the
+ * scanner forces the full fence on all the running threads instead.
+ */
+static atomic_bool hp_membarrier = ATOMIC_VAR_INIT(false);
+
+int hp_membarrier_enable(void)
+{
+    long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+
+    if (cmds < 0 || !(cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED))
+        return -1;
+    if (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0,
+                0))
+        return -1;
+    atomic_store(&hp_membarrier, true);
+
+    return 0;
+}
+
+/* The scanner side of the fence, pairs with the one in the readers. */
+static inline void hp_scan_fence(void)
+{
+    if (atomic_load_explicit(&hp_membarrier, memory_order_relaxed) &&
+        !syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0))
+        return;
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/* All the alive hp_t, for handing off the retire lists on unregister.
+ * The lock only protects the list, the handoff runs the delete_func so it
+ * is done outside the lock with a reference to each hp_t.
+ */
+static hp_t *hp_domains;
+static atomic_flag hp_domains_lock = ATOMIC_FLAG_INIT;
+
+static inline void hp_domains_acquire(void)
+{
+    while (atomic_flag_test_and_set_explicit(&hp_domains_lock,
+                                             memory_order_acquire))
+        ;
+}
+
+static inline void hp_domains_release(void)
+{
+    atomic_flag_clear_explicit(&hp_domains_lock, memory_order_release);
+}
+
+static int __tid_pop(void)
+{
+    uint_fast64_t head, new;
+    uint32_t idx;
+
+    head = atomic_load_explicit(&__tid_free, memory_order_acquire);
+    do {
+        idx = (uint32_t)head;
+        if (idx == 0)
+            return HP_TID_UNINIT;
+        new = ((head >> 32) + 1) << 32 |
+              atomic_load_explicit(&__tid_free_next[idx - 1],
+                                   memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &__tid_free, &head, new, memory_order_acq_rel, memory_order_acquire));
+
+    return idx - 1;
+}
+
+static void __tid_push(int slot)
+{
+    uint_fast64_t head, new;
+
+    head = atomic_load_explicit(&__tid_free, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&__tid_free_next[slot], (uint32_t)head,
+                              memory_order_relaxed);
+        new = ((head >> 32) + 1) << 32 | (uint32_t)(slot + 1);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &__tid_free, &head, new, memory_order_release, memory_order_relaxed));
+}
 
-#define __update_tid()                                                    \
-    ({                                                                    \
-        tid = atomic_fetch_add_explicit(&__tid, 1, memory_order_consume); \
-        assert(tid < HP_MAX_THREAD_RL);                                   \
-        tid;                                                              \
-    })
+int hp_thread_hwm(void)
+{
+    return atomic_load_explicit(&__tid_hwm, memory_order_acquire);
+}
+
+int hp_thread_register(void)
+{
+    if (tid != HP_TID_UNINIT)
+        return tid;
+
+    tid = __tid_pop();
+    if (tid == HP_TID_UNINIT) {
+        tid = atomic_fetch_add_explicit(&__tid_hwm, 1, memory_order_acq_rel);
+        assert(tid < HP_MAX_THREAD_RL);
+    }
+
+    return tid;
+}
 
 static inline int get_tid(void)
 {
-    return (tid == HP_TID_UNINIT) ? __update_tid() : tid;
+    return (tid == HP_TID_UNINIT) ? hp_thread_register() : tid;
+}
+
+static struct hp_rl_chunk *hp_rl_chunk_alloc(retirelist_t *rl)
+{
+    struct hp_rl_chunk *chunk = rl->spare;
+
+    if (chunk) {
+        rl->spare = NULL;
+        return chunk;
+    }
+
+    chunk = aligned_alloc(COHERENCE_PAD, HP_RL_CHUNK_SIZE);
+    assert(chunk);
+    return chunk;
+}
+
+static void hp_rl_chunk_free(retirelist_t *rl, struct hp_rl_chunk *chunk)
+{
+    if (!rl->spare)
+        rl->spare = chunk;
+    else
+        free(chunk);
+}
+
+static inline void hp_rl_init(retirelist_t *rl)
+{
+    rl->size = 0;
+    rl->next_scan = 0;
+    rl->head = NULL;
+    rl->spare = NULL;
+}
+
+static inline void hp_rl_push(retirelist_t *rl, uintptr_t ptr)
+{
+    struct hp_rl_chunk *chunk = rl->head;
+
+    if (!chunk || chunk->size == HP_RL_CHUNK_NR) {
+        chunk = hp_rl_chunk_alloc(rl);
+        chunk->size = 0;
+        chunk->next = rl->head;
+        rl->head = chunk;
+    }
+    chunk->list[chunk->size++] = ptr;
+    rl->size++;
+}
+
+/* Delete all the retired pointers, used when no one can access them. */
+static void hp_rl_destory(retirelist_t *rl, void (*delete_func)(void *))
+{
+    struct hp_rl_chunk *chunk, *tmp;
+    size_t i;
+
+    for (chunk = rl->head; chunk; chunk = tmp) {
+        tmp = chunk->next;
+        if (delete_func)
+            for (i = 0; i < chunk->size; i++)
+                delete_func((void *)chunk->list[i]);
+        free(chunk);
+    }
+    free(rl->spare);
+    hp_rl_init(rl);
 }
 
 hp_t *hp_new(void (*delete_func)(void *))
@@ -68,53 +291,629 @@ hp_t *hp_new(void (*delete_func)(void *))
 
     assert(hp);
     hp->delete_func = delete_func;
+    hp->scan_mode = HP_SCAN_SNAPSHOT;
+    hp->scan_threshold = 0;
+    hp->bp_policy = HP_BP_SCAN;
+    hp->bp_limit = HP_RL_LIMIT;
+    atomic_init(&hp->nr_backpressure, 0);
+    atomic_init(&hp->reclaimer, NULL);
+    atomic_init(&hp->orphans, NULL);
+    atomic_init(&hp->refs, 0);
     for (i = 0; i < HP_MAX_THREAD_RL; i++) {
-        hp->thread_info[i].rl.list =
-            calloc(HP_MAX_THREAD_RL, sizeof(uintptr_t));
-        assert(hp->thread_info[i].rl.list);
+        hp_rl_init(&hp->thread_info[i].rl);
+        hp->thread_info[i].async = NULL;
+        atomic_init(&hp->thread_info[i].async_pin, 0);
+        atomic_init(&hp->thread_info[i].peak, 0);
         for (j = 0; j < HP_MAX_PTR; j++)
             atomic_init(&hp->thread_info[i].hp[j], 0);
     }
 
+    hp_domains_acquire();
+    hp->next = hp_domains;
+    hp_domains = hp;
+    hp_domains_release();
+
     return hp;
 }
 
+static inline void __hp_delete(hp_t *hp, uintptr_t obj)
+{
+    if (hp->delete_func)
+        hp->delete_func((void *)obj);
+}
+
 void hp_destory(hp_t *hp)
 {
+    struct hp_orphan *orphan, *tmp;
+    hp_t **indirect;
     int i;
     assert(hp);
 
-    for (i = 0; i < HP_MAX_THREAD_RL; i++)
-        free(hp->thread_info[i].rl.list);
+    hp_domains_acquire();
+    for (indirect = &hp_domains; *indirect != hp;
+         indirect = &(*indirect)->next)
+        ;
+    *indirect = hp->next;
+    hp_domains_release();
+
+    /* Wait for the unregistering threads which have taken it before the
+     * unlinking, they may still use the reclaimer.
+     */
+    while (atomic_load_explicit(&hp->refs, memory_order_acquire))
+        sched_yield();
+
+    hp_reclaimer_stop(hp);
+
+    /* No one can hold a hazard pointer anymore, free all the retired. */
+    for (i = 0; i < HP_MAX_THREAD_RL; i++) {
+        hp_rl_destory(&hp->thread_info[i].rl, hp->delete_func);
+        /* The batch which has never been sent to the reclaimer */
+        if (hp->thread_info[i].async) {
+            hp->thread_info[i].rl.head = hp->thread_info[i].async;
+            hp_rl_destory(&hp->thread_info[i].rl, hp->delete_func);
+        }
+    }
+    for (orphan = atomic_load(&hp->orphans); orphan; orphan = tmp) {
+        tmp = orphan->next;
+        hp_rl_destory(&orphan->rl, hp->delete_func);
+        free(orphan);
+    }
     free(hp);
 }
 
-void hp_retirelist(hp_t *hp, uintptr_t ptr)
+void hp_scan_mode(hp_t *hp, int mode, size_t threshold)
+{
+    assert(mode == HP_SCAN_LINEAR || mode == HP_SCAN_SNAPSHOT);
+
+    hp->scan_mode = mode;
+    hp->scan_threshold = threshold;
+}
+
+void hp_backpressure(hp_t *hp, int policy, size_t limit)
+{
+    assert(policy == HP_BP_SCAN || policy == HP_BP_HANDOFF);
+
+    hp->bp_policy = policy;
+    hp->bp_limit = limit ? limit : HP_RL_LIMIT;
+}
+
+void hp_stat(hp_t *hp, struct hp_stat *stat)
 {
-    int i, j, k;
-    bool freeable;
+    struct hp_orphan *orphan;
+    size_t peak;
+    int i, hwm = hp_thread_hwm();
+
+    stat->peak_depth = 0;
+    for (i = 0; i < hwm; i++) {
+        peak = atomic_load_explicit(&hp->thread_info[i].peak,
+                                    memory_order_relaxed);
+        if (peak > stat->peak_depth)
+            stat->peak_depth = peak;
+    }
+    stat->nr_backpressure =
+        atomic_load_explicit(&hp->nr_backpressure, memory_order_relaxed);
+
+    /* Only the pointer is read, the orphans may be taken at any time. */
+    orphan = atomic_load_explicit(&hp->orphans, memory_order_acquire);
+    stat->has_orphan = (orphan != NULL);
+}
+
+/* The default threshold follows the active threads, 2 * T * H. */
+static inline size_t hp_scan_threshold(hp_t *hp)
+{
+    if (hp->scan_threshold)
+        return hp->scan_threshold;
+    return 2 * hp_thread_hwm() * HP_MAX_PTR;
+}
+
+/* Compact the retire list, delete every retired pointer which is not
+ * protected. The write cursor never passes the read cursor, so the chunks
+ * are reused in place and the empty ones at the tail are released.
+ */
+static void hp_rl_reclaim(hp_t *hp, retirelist_t *rl,
+                          bool (*protected)(hp_t *, uintptr_t,
+                                            const uintptr_t *, size_t),
+                          const uintptr_t *snapshot, size_t nr)
+{
+    struct hp_rl_chunk *rd, *wr = rl->head, *tmp;
+    size_t i, w = 0;
     uintptr_t obj;
+
+    for (rd = rl->head; rd; rd = rd->next) {
+        for (i = 0; i < rd->size; i++) {
+            obj = rd->list[i];
+            if (!protected(hp, obj, snapshot, nr)) {
+                rl->size--;
+                __hp_delete(hp, obj);
+                continue;
+            }
+            if (w == HP_RL_CHUNK_NR) {
+                wr = wr->next;
+                w = 0;
+            }
+            wr->list[w++] = obj;
+        }
+    }
+
+    if (!wr)
+        return;
+
+    /* The chunks before wr are full, wr itself keeps w entries. */
+    for (rd = rl->head; rd != wr; rd = rd->next)
+        rd->size = HP_RL_CHUNK_NR;
+    wr->size = w;
+    for (rd = wr->next, wr->next = NULL; rd; rd = tmp) {
+        tmp = rd->next;
+        hp_rl_chunk_free(rl, rd);
+    }
+    if (rl->size == 0) {
+        hp_rl_chunk_free(rl, rl->head);
+        rl->head = NULL;
+    }
+}
+
+/* The original scan: compare each retired pointer with every published
+ * hazard pointer, O(R * T * H) per retire.
+ */
+static bool __hp_protected_linear(hp_t *hp, uintptr_t obj,
+                                  const uintptr_t *snapshot, size_t nr)
+{
+    int j, k, hwm = hp_thread_hwm();
+
+    for (j = 0; j < hwm; j++) {
+        for (k = 0; k < HP_MAX_PTR; k++) {
+            if (atomic_load(&hp->thread_info[j].hp[k]) == obj)
+                return true;
+        } /* for each hp in thread_info[j] */
+    } /* for each thread_info in hp_t */
+
+    return false;
+}
+
+static void __hp_scan_linear(hp_t *hp, retirelist_t *rl)
+{
+    hp_scan_fence();
+    hp_rl_reclaim(hp, rl, __hp_protected_linear, NULL, 0);
+}
+
+static int __hp_cmp(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static bool __hp_protected_snapshot(hp_t *hp, uintptr_t obj,
+                                    const uintptr_t *snapshot, size_t nr)
+{
+    return bsearch(&obj, snapshot, nr, sizeof(uintptr_t), __hp_cmp) != NULL;
+}
+
+/* Collect the published hazard pointers of the active slots, sorted. */
+static size_t __hp_snapshot(hp_t *hp, uintptr_t *snapshot)
+{
+    int j, k, hwm = hp_thread_hwm();
+    size_t nr = 0;
+    uintptr_t ptr;
+
+    hp_scan_fence();
+
+    for (j = 0; j < hwm; j++) {
+        for (k = 0; k < HP_MAX_PTR; k++) {
+            ptr = atomic_load_explicit(&hp->thread_info[j].hp[k],
+                                       memory_order_acquire);
+            if (ptr)
+                snapshot[nr++] = ptr;
+        }
+    }
+    qsort(snapshot, nr, sizeof(uintptr_t), __hp_cmp);
+
+    return nr;
+}
+
+static void __hp_orphan_push(hp_t *hp, struct hp_orphan *orphan)
+{
+    struct hp_orphan *head;
+
+    head = atomic_load_explicit(&hp->orphans, memory_order_relaxed);
+    do {
+        orphan->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &hp->orphans, &head, orphan, memory_order_release,
+        memory_order_relaxed));
+}
+
+/* Take over the orphaned retire lists, the still protected one go back. */
+static void __hp_reclaim_orphans(hp_t *hp, uintptr_t *snapshot, size_t nr)
+{
+    struct hp_orphan *orphan, *tmp;
+
+    orphan = atomic_exchange_explicit(&hp->orphans, NULL, memory_order_acquire);
+    for (; orphan; orphan = tmp) {
+        tmp = orphan->next;
+        hp_rl_reclaim(hp, &orphan->rl, __hp_protected_snapshot, snapshot, nr);
+        if (orphan->rl.size == 0) {
+            hp_rl_destory(&orphan->rl, NULL);
+            free(orphan);
+            continue;
+        }
+        __hp_orphan_push(hp, orphan);
+    }
+}
+
+/* Snapshot all the published hazard pointers once, sort them and then
+ * binary search each retired pointer, O(T * H * log(T * H) + R * log(T * H)).
+ */
+static void __hp_scan_snapshot(hp_t *hp, retirelist_t *rl)
+{
+    uintptr_t snapshot[HP_MAX_HAZARD];
+    size_t nr;
+
+    nr = __hp_snapshot(hp, snapshot);
+    hp_rl_reclaim(hp, rl, __hp_protected_snapshot, snapshot, nr);
+    if (atomic_load_explicit(&hp->orphans, memory_order_relaxed))
+        __hp_reclaim_orphans(hp, snapshot, nr);
+}
+
+static void __hp_orphan_handoff(hp_t *hp, retirelist_t *rl)
+{
+    struct hp_orphan *orphan = malloc(sizeof(struct hp_orphan));
+
+    assert(orphan);
+    hp_rl_init(&orphan->rl);
+    orphan->rl.size = rl->size;
+    orphan->rl.head = rl->head;
+    rl->size = 0;
+    rl->next_scan = 0;
+    rl->head = NULL;
+    __hp_orphan_push(hp, orphan);
+}
+
+/* The retire list is too deep, the readers hold the most of it or the
+ * threshold is too large. Either scan right now or hand the list off to
+ * whoever calls hp_scan() next, e.g. a helper thread.
+ */
+static void hp_rl_backpressure(hp_t *hp, retirelist_t *rl)
+{
+    atomic_fetch_add_explicit(&hp->nr_backpressure, 1, memory_order_relaxed);
+
+    if (hp->bp_policy == HP_BP_HANDOFF)
+        __hp_orphan_handoff(hp, rl);
+    else
+        __hp_scan_snapshot(hp, rl);
+}
+
+static void __hp_async_push(struct hp_reclaimer *rcl, struct hp_rl_chunk *chunk)
+{
+    struct hp_rl_chunk *head;
+
+    head = atomic_load_explicit(&rcl->queue, memory_order_relaxed);
+    do {
+        chunk->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &rcl->queue, &head, chunk, memory_order_release,
+        memory_order_relaxed));
+}
+
+/* The writer only fills its batch, the full batch goes to the reclaimer. */
+static inline void __hp_async_retire(struct hp_reclaimer *rcl, th_info_t *thi,
+                                     uintptr_t ptr)
+{
+    struct hp_rl_chunk *chunk = thi->async;
+
+    if (!chunk) {
+        chunk = aligned_alloc(COHERENCE_PAD, HP_RL_CHUNK_SIZE);
+        assert(chunk);
+        chunk->next = NULL;
+        chunk->size = 0;
+        thi->async = chunk;
+    }
+    chunk->list[chunk->size++] = ptr;
+    if (chunk->size == HP_RL_CHUNK_NR) {
+        thi->async = NULL;
+        __hp_async_push(rcl, chunk);
+    }
+}
+
+/* Send the partial batch of the caller to the reclaimer. */
+static void __hp_async_commit(struct hp_reclaimer *rcl, th_info_t *thi)
+{
+    if (thi->async && thi->async->size) {
+        __hp_async_push(rcl, thi->async);
+        thi->async = NULL;
+    }
+}
+
+/* Pin the reclaimer before using it. hp_reclaimer_stop() unpublishes it
+ * and then waits for the pinned threads, so either the caller sees NULL or
+ * the stopper sees the pin and nothing is pushed after the reclaimer exits.
+ */
+static inline struct hp_reclaimer *__hp_async_get(hp_t *hp, th_info_t *thi)
+{
+    struct hp_reclaimer *rcl;
+
+    atomic_store(&thi->async_pin, 1);
+    rcl = atomic_load(&hp->reclaimer);
+    if (!rcl)
+        atomic_store_explicit(&thi->async_pin, 0, memory_order_release);
+    return rcl;
+}
+
+static inline void __hp_async_put(th_info_t *thi)
+{
+    atomic_store_explicit(&thi->async_pin, 0, memory_order_release);
+}
+
+/* Take back the partial batch left over after the reclaimer has stopped. */
+static void __hp_async_reclaim(th_info_t *thi)
+{
+    struct hp_rl_chunk *chunk = thi->async;
+    size_t i;
+
+    thi->async = NULL;
+    for (i = 0; i < chunk->size; i++)
+        hp_rl_push(&thi->rl, chunk->list[i]);
+    free(chunk);
+}
+
+void hp_retirelist(hp_t *hp, uintptr_t ptr)
+{
     th_info_t *thi = &hp->thread_info[get_tid()];
-    thi->rl.list[thi->rl.size++] = ptr;
-    assert(thi->rl.size < HP_MAX_THREAD_RL);
+    retirelist_t *rl = &thi->rl;
+    struct hp_reclaimer *rcl;
 
-    for (i = 0; i < HP_MAX_THREAD_RL; i++) {
-        freeable = true;
-        obj = thi->rl.list[i];
-        for (j = 0; j < HP_MAX_THREAD_RL && freeable; j++) {
-            for (k = 0; k < HP_MAX_PTR; k++) {
-                if (atomic_load(&hp->thread_info[j].hp[k]) == obj) {
-                    freeable = false;
-                    break;
-                }
-            } /* for each hp in thread_info[j] */
-        } /* for each thread_info in hp_t */
-        if (freeable) {
-            memmove(&thi->rl.list[i], &thi->rl.list[--thi->rl.size],
-                    sizeof(uintptr_t));
-            hp->delete_func((void *)obj);
+    if (atomic_load_explicit(&hp->reclaimer, memory_order_relaxed)) {
+        rcl = __hp_async_get(hp, thi);
+        if (rcl) {
+            __hp_async_retire(rcl, thi, ptr);
+            __hp_async_put(thi);
+            return;
         }
-    } /* for each uintptr in thi->rl */
+    }
+    if (thi->async)
+        __hp_async_reclaim(thi);
+
+    hp_rl_push(rl, ptr);
+    if (rl->size > atomic_load_explicit(&thi->peak, memory_order_relaxed))
+        atomic_store_explicit(&thi->peak, rl->size, memory_order_relaxed);
+
+    if (!rl->next_scan)
+        rl->next_scan = hp_scan_threshold(hp);
+
+    if (hp->scan_mode == HP_SCAN_LINEAR) {
+        __hp_scan_linear(hp, rl);
+    } else if (rl->size >= rl->next_scan) {
+        /* Batch the retired pointers, amortize the snapshot over them. */
+        __hp_scan_snapshot(hp, rl);
+        rl->next_scan = rl->size + hp_scan_threshold(hp);
+    }
+
+    if (rl->size >= hp->bp_limit)
+        hp_rl_backpressure(hp, rl);
+}
+
+void hp_scan(hp_t *hp)
+{
+    th_info_t *thi = &hp->thread_info[get_tid()];
+
+    __hp_scan_snapshot(hp, &thi->rl);
+}
+
+/* Link all the queued batches in front of the reclaimer's retire list. */
+static void __hp_async_splice(struct hp_reclaimer *rcl, retirelist_t *rl)
+{
+    struct hp_rl_chunk *chunk, *first;
+
+    first = atomic_exchange_explicit(&rcl->queue, NULL, memory_order_acquire);
+    if (!first)
+        return;
+
+    for (chunk = first;; chunk = chunk->next) {
+        rl->size += chunk->size;
+        if (!chunk->next)
+            break;
+    }
+    chunk->next = rl->head;
+    rl->head = first;
+}
+
+static void *hp_reclaimer_fn(void *arg)
+{
+    struct hp_reclaimer *rcl = (struct hp_reclaimer *)arg;
+    hp_t *hp = rcl->hp;
+    retirelist_t *rl = &hp->thread_info[get_tid()].rl;
+    struct timespec ts;
+    uint64_t request;
+    bool stop;
+
+    for (;;) {
+        pthread_mutex_lock(&rcl->lock);
+        if (!rcl->stop && rcl->request == rcl->done) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += HP_RECLAIM_PERIOD_NS;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&rcl->wake, &rcl->lock, &ts);
+        }
+        request = rcl->request;
+        stop = rcl->stop;
+        pthread_mutex_unlock(&rcl->lock);
+
+        __hp_async_splice(rcl, rl);
+        if (rl->size || atomic_load_explicit(&hp->orphans, memory_order_relaxed))
+            __hp_scan_snapshot(hp, rl);
+
+        pthread_mutex_lock(&rcl->lock);
+        rcl->done = request;
+        pthread_cond_broadcast(&rcl->idle);
+        pthread_mutex_unlock(&rcl->lock);
+
+        if (stop && !atomic_load(&rcl->queue))
+            break;
+    }
+
+    hp_thread_unregister();
+
+    return NULL;
+}
+
+int hp_reclaimer_start(hp_t *hp)
+{
+    struct hp_reclaimer *rcl;
+
+    if (atomic_load(&hp->reclaimer))
+        return 0;
+
+    rcl = malloc(sizeof(struct hp_reclaimer));
+    if (!rcl)
+        return -1;
+    rcl->hp = hp;
+    atomic_init(&rcl->queue, NULL);
+    rcl->stop = false;
+    rcl->request = 0;
+    rcl->done = 0;
+    if (pthread_mutex_init(&rcl->lock, NULL))
+        goto free_rcl;
+    if (pthread_cond_init(&rcl->wake, NULL))
+        goto destroy_lock;
+    if (pthread_cond_init(&rcl->idle, NULL))
+        goto destroy_wake;
+
+    atomic_store_explicit(&hp->reclaimer, rcl, memory_order_release);
+    if (pthread_create(&rcl->thread, NULL, hp_reclaimer_fn, rcl)) {
+        atomic_store(&hp->reclaimer, NULL);
+        goto destroy_idle;
+    }
+
+    return 0;
+
+destroy_idle:
+    pthread_cond_destroy(&rcl->idle);
+destroy_wake:
+    pthread_cond_destroy(&rcl->wake);
+destroy_lock:
+    pthread_mutex_destroy(&rcl->lock);
+free_rcl:
+    free(rcl);
+    return -1;
+}
+
+void hp_reclaimer_flush(hp_t *hp)
+{
+    th_info_t *thi = &hp->thread_info[get_tid()];
+    struct hp_reclaimer *rcl;
+    uint64_t request;
+
+    rcl = __hp_async_get(hp, thi);
+    if (!rcl)
+        return;
+
+    __hp_async_commit(rcl, thi);
+
+    pthread_mutex_lock(&rcl->lock);
+    request = ++rcl->request;
+    pthread_cond_signal(&rcl->wake);
+    while (rcl->done < request)
+        pthread_cond_wait(&rcl->idle, &rcl->lock);
+    pthread_mutex_unlock(&rcl->lock);
+
+    __hp_async_put(thi);
+}
+
+void hp_reclaimer_stop(hp_t *hp)
+{
+    th_info_t *thi = &hp->thread_info[get_tid()];
+    struct hp_reclaimer *rcl;
+    int i, hwm;
+
+    /* Unpublish it before the stop, the writers fall back to their own
+     * retire lists. The ones which have already pinned it are waited.
+     */
+    rcl = atomic_exchange(&hp->reclaimer, NULL);
+    if (!rcl)
+        return;
+    hwm = hp_thread_hwm();
+    for (i = 0; i < hwm; i++) {
+        while (atomic_load_explicit(&hp->thread_info[i].async_pin,
+                                    memory_order_acquire))
+            sched_yield();
+    }
+
+    __hp_async_commit(rcl, thi);
+
+    pthread_mutex_lock(&rcl->lock);
+    rcl->stop = true;
+    pthread_cond_signal(&rcl->wake);
+    pthread_mutex_unlock(&rcl->lock);
+    pthread_join(rcl->thread, NULL);
+
+    /* No one can push anymore, drain whatever is still queued. */
+    __hp_async_splice(rcl, &thi->rl);
+    if (thi->rl.size)
+        __hp_scan_snapshot(hp, &thi->rl);
+
+    pthread_cond_destroy(&rcl->idle);
+    pthread_cond_destroy(&rcl->wake);
+    pthread_mutex_destroy(&rcl->lock);
+    free(rcl);
+}
+
+/* Hand off the retire list of the leaving thread, the chunks themselves
+ * go to the orphan list and the slot starts empty for the next owner.
+ */
+static void __hp_handoff(hp_t *hp, th_info_t *thi)
+{
+    struct hp_reclaimer *rcl;
+    int k;
+
+    for (k = 0; k < HP_MAX_PTR; k++)
+        atomic_store_explicit(&thi->hp[k], 0, memory_order_release);
+
+    rcl = __hp_async_get(hp, thi);
+    if (rcl) {
+        __hp_async_commit(rcl, thi);
+        __hp_async_put(thi);
+    }
+    if (thi->async)
+        __hp_async_reclaim(thi);
+
+    if (thi->rl.size)
+        __hp_scan_snapshot(hp, &thi->rl);
+    if (thi->rl.size)
+        __hp_orphan_handoff(hp, &thi->rl);
+    thi->rl.next_scan = 0;
+}
+
+void hp_thread_unregister(void)
+{
+    hp_t *hp, **domains;
+    int i, nr = 0;
+
+    if (tid == HP_TID_UNINIT)
+        return;
+
+    /* Snapshot the domains with the references under the lock. */
+    hp_domains_acquire();
+    for (hp = hp_domains; hp; hp = hp->next)
+        nr++;
+    domains = malloc(sizeof(hp_t *) * (nr ? nr : 1));
+    assert(domains);
+    for (i = 0, hp = hp_domains; hp; hp = hp->next, i++) {
+        atomic_fetch_add_explicit(&hp->refs, 1, memory_order_relaxed);
+        domains[i] = hp;
+    }
+    hp_domains_release();
+
+    for (i = 0; i < nr; i++) {
+        __hp_handoff(domains[i], &domains[i]->thread_info[tid]);
+        atomic_fetch_sub_explicit(&domains[i]->refs, 1, memory_order_release);
+    }
+    free(domains);
+
+    __tid_push(tid);
+    tid = HP_TID_UNINIT;
 }
 
 static inline uintptr_t __hp_protect_release(hp_t *hp, int hp_index,
@@ -130,11 +929,52 @@ uintptr_t hp_protect_release(hp_t *hp, int hp_index, uintptr_t ptr)
 
 static inline void __hp_protect_clear(hp_t *hp)
 {
-    int i, j;
-    for (i = 0; i < HP_MAX_THREAD_RL; i++)
+    int i, j, hwm = hp_thread_hwm();
+    for (i = 0; i < hwm; i++)
         for (j = 0; j < HP_MAX_PTR; j++)
             atomic_store(&hp->thread_info[i].hp[j], 0);
     atomic_thread_fence(memory_order_release);
 }
 
 void hp_protect_clear(hp_t *hp) __attribute__((alias("__hp_protect_clear")));
+
+/* Publish the harzard pointer and validate it against src. The seq_cst
+ * store orders the publication before the reload (the scanner side has
+ * the seq_cst fence), which is a single xchg on x86 instead of a release
+ * store followed by mfence. With the membarrier, the compiler barrier is
+ * enough.
+ */
+uintptr_t hp_protect_load(hp_t *hp, int hp_index, atomic_uintptr_t *src)
+{
+    atomic_uintptr_t *slot = &hp->thread_info[get_tid()].hp[hp_index];
+    uintptr_t ptr, tmp;
+
+    ptr = atomic_load_explicit(src, memory_order_relaxed);
+    if (atomic_load_explicit(&hp_membarrier, memory_order_relaxed)) {
+        for (;;) {
+            atomic_store_explicit(slot, ptr, memory_order_relaxed);
+            atomic_signal_fence(memory_order_seq_cst);
+            tmp = atomic_load_explicit(src, memory_order_acquire);
+            if (tmp == ptr)
+                return ptr;
+            ptr = tmp;
+        }
+    }
+
+    for (;;) {
+        atomic_store_explicit(slot, ptr, memory_order_seq_cst);
+        tmp = atomic_load_explicit(src, memory_order_seq_cst);
+        if (tmp == ptr)
+            return ptr;
+        ptr = tmp;
+    }
+}
+
+void hp_clear_local(hp_t *hp)
+{
+    th_info_t *thi = &hp->thread_info[get_tid()];
+    int k;
+
+    for (k = 0; k < HP_MAX_PTR; k++)
+        atomic_store_explicit(&thi->hp[k], 0, memory_order_release);
+}
@@ -19,14 +19,89 @@
 #ifndef __HAZARD_POINTER_H__
 #define __HAZARD_POINTER_H__
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
 typedef struct hp_struct hp_t;
 
+/* The scan of hp_retirelist():
+ * - HP_SCAN_LINEAR: compare each retired pointer with all the hazard pointers
+ *   on every retire.
+ * - HP_SCAN_SNAPSHOT (default): when the per-thread retire list reaches the
+ *   threshold, snapshot and sort the hazard pointers once then binary search
+ *   the whole retire list. The default threshold (0) is
+ *   2 * active threads * hazards.
+ */
+enum {
+    HP_SCAN_LINEAR = 0,
+    HP_SCAN_SNAPSHOT = 1,
+};
+
+/* Back-pressure when a retire list grows over the limit (default 0 means
+ * 8 * the maximum of hazard pointers):
+ * - HP_BP_SCAN (default): force a scan right now.
+ * - HP_BP_HANDOFF: move the whole list to the hp_t, it will be reclaimed by
+ *   the next hp_scan() from any thread, e.g. a helper thread.
+ */
+enum {
+    HP_BP_SCAN = 0,
+    HP_BP_HANDOFF = 1,
+};
+
+struct hp_stat {
+    size_t peak_depth; /* the deepest retire list ever seen */
+    size_t nr_backpressure;
+    int has_orphan;
+};
+
+/* The thread slot is taken on the first use of hp_t, or explicitly by
+ * hp_thread_register(). A leaving thread should call hp_thread_unregister()
+ * to recycle its slot, its retire lists are handed off to the hp_t.
+ * hp_thread_hwm() is the high-water mark of the slots ever used.
+ */
+int hp_thread_register(void);
+void hp_thread_unregister(void);
+int hp_thread_hwm(void);
+
+/* Opt-in asymmetric fence: the scans issue membarrier(2) so the readers in
+ * hp_protect_load() only need the compiler barrier. It returns -1 and keeps
+ * the full fences if the kernel does not support it. Call it before any
+ * reader starts.
+ */
+int hp_membarrier_enable(void);
+
 hp_t *hp_new(void (*delete_func)(void *));
 void hp_destory(hp_t *hp);
+void hp_scan_mode(hp_t *hp, int mode, size_t threshold);
+void hp_backpressure(hp_t *hp, int policy, size_t limit);
+void hp_stat(hp_t *hp, struct hp_stat *stat);
 void hp_retirelist(hp_t *hp, uintptr_t ptr);
+void hp_scan(hp_t *hp);
+
+/* Asynchronous reclamation: after hp_reclaimer_start(), hp_retirelist()
+ * only batches the pointer and a dedicated reclaimer thread does the scans
+ * and calls delete_func. A batch is sent when it is full, or by
+ * hp_reclaimer_flush() and hp_thread_unregister() of the retiring thread.
+ * hp_reclaimer_flush() waits until the reclaimer has scanned everything
+ * sent so far, hp_reclaimer_stop() (also called by hp_destory()) drains
+ * the queue and joins the reclaimer. It is safe against the concurrent
+ * hp_retirelist(): the writers fall back to their own retire lists and
+ * take back the batches they have not sent yet.
+ */
+int hp_reclaimer_start(hp_t *hp);
+void hp_reclaimer_flush(hp_t *hp);
+void hp_reclaimer_stop(hp_t *hp);
+
+/* hp_protect_release() only publishes the pointer, the caller has to issue
+ * a full fence and validate it. hp_protect_load() does the whole validated
+ * load from src and returns the protected pointer.
+ * hp_clear_local() clears the harzard pointers of the caller only, while
+ * hp_protect_clear() clears the ones of every thread.
+ */
 uintptr_t hp_protect_release(hp_t *hp, int hp_index, uintptr_t ptr);
+uintptr_t hp_protect_load(hp_t *hp, int hp_index, atomic_uintptr_t *src);
+void hp_clear_local(hp_t *hp);
 void hp_protect_clear(hp_t *hp);
 
 #define HP_DEFINE4(n0, n1, n2, n3) \
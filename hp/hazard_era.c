@@ -0,0 +1,237 @@
+/*
+ * hazard eras: The era-based sibling of the harzard pointer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hazard_era.h"
+#include "harzard_pointer.h"
+
+#define HE_MAX_THREAD 128
+#define HE_MAX_ERA 4
+#define COHERENCE_PAD 128
+/* Advance the era clock every HE_ERA_FREQ retires of a thread. */
+#define HE_ERA_FREQ 64
+#define HE_SCAN_THRESHOLD 128
+#define HE_ERA_NONE 0
+
+/* In front of every object, keeps the user pointer 16 bytes aligned. */
+struct he_header {
+    uint64_t birth;
+    uint64_t retire;
+};
+
+#define he_header_of(ptr) ((struct he_header *)(ptr)-1)
+
+typedef struct {
+    size_t size;
+    size_t capacity;
+    size_t next_scan;
+    uintptr_t *list;
+} he_retirelist_t;
+
+typedef struct {
+    alignas(COHERENCE_PAD / 2) atomic_uint_fast64_t era[HE_MAX_ERA];
+    alignas(COHERENCE_PAD / 2) he_retirelist_t rl;
+    unsigned long nr_retire;
+} he_th_info_t;
+
+typedef struct he_struct {
+    alignas(COHERENCE_PAD) he_th_info_t thread_info[HE_MAX_THREAD];
+    alignas(COHERENCE_PAD) atomic_uint_fast64_t era;
+    void (*delete_func)(void *);
+} he_t;
+
+static inline int he_get_tid(void)
+{
+    int tid = hp_thread_register();
+
+    assert(tid < HE_MAX_THREAD);
+    return tid;
+}
+
+he_t *he_new(void (*delete_func)(void *))
+{
+    int i, j;
+    he_t *he = aligned_alloc(COHERENCE_PAD, sizeof(he_t));
+
+    assert(he);
+    he->delete_func = delete_func;
+    atomic_init(&he->era, HE_ERA_NONE + 1);
+    for (i = 0; i < HE_MAX_THREAD; i++) {
+        he->thread_info[i].rl.size = 0;
+        he->thread_info[i].rl.capacity = 0;
+        he->thread_info[i].rl.next_scan = HE_SCAN_THRESHOLD;
+        he->thread_info[i].rl.list = NULL;
+        he->thread_info[i].nr_retire = 0;
+        for (j = 0; j < HE_MAX_ERA; j++)
+            atomic_init(&he->thread_info[i].era[j], HE_ERA_NONE);
+    }
+
+    return he;
+}
+
+void he_destory(he_t *he)
+{
+    he_retirelist_t *rl;
+    size_t j;
+    int i;
+
+    /* No one can hold an era anymore, free all the retired. */
+    for (i = 0; i < HE_MAX_THREAD; i++) {
+        rl = &he->thread_info[i].rl;
+        for (j = 0; j < rl->size; j++) {
+            if (he->delete_func)
+                he->delete_func((void *)rl->list[j]);
+        }
+        free(rl->list);
+    }
+    free(he);
+}
+
+void *he_alloc(he_t *he, size_t size)
+{
+    struct he_header *header = malloc(sizeof(struct he_header) + size);
+
+    if (!header)
+        return NULL;
+    header->birth = atomic_load_explicit(&he->era, memory_order_acquire);
+    header->retire = HE_ERA_NONE;
+
+    return header + 1;
+}
+
+void he_free(void *ptr)
+{
+    if (ptr)
+        free(he_header_of(ptr));
+}
+
+static int __he_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Is there any published era in [birth, retire] ? */
+static bool __he_protected(const uint64_t *snapshot, size_t nr,
+                           struct he_header *header)
+{
+    size_t lo = 0, hi = nr, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (snapshot[mid] < header->birth)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo < nr && snapshot[lo] <= header->retire;
+}
+
+static void __he_scan(he_t *he, he_retirelist_t *rl)
+{
+    uint64_t snapshot[HE_MAX_THREAD * HE_MAX_ERA];
+    int j, k, hwm = hp_thread_hwm();
+    size_t i, nr = 0;
+    uint64_t era;
+    uintptr_t obj;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for (j = 0; j < hwm && j < HE_MAX_THREAD; j++) {
+        for (k = 0; k < HE_MAX_ERA; k++) {
+            era = atomic_load_explicit(&he->thread_info[j].era[k],
+                                       memory_order_acquire);
+            if (era != HE_ERA_NONE)
+                snapshot[nr++] = era;
+        }
+    }
+    qsort(snapshot, nr, sizeof(uint64_t), __he_cmp);
+
+    for (i = 0; i < rl->size;) {
+        obj = rl->list[i];
+        if (__he_protected(snapshot, nr, he_header_of(obj))) {
+            i++;
+            continue;
+        }
+        rl->list[i] = rl->list[--rl->size];
+        if (he->delete_func)
+            he->delete_func((void *)obj);
+    }
+}
+
+void he_retirelist(he_t *he, uintptr_t ptr)
+{
+    he_th_info_t *thi = &he->thread_info[he_get_tid()];
+    he_retirelist_t *rl = &thi->rl;
+
+    he_header_of(ptr)->retire =
+        atomic_load_explicit(&he->era, memory_order_acquire);
+
+    if (rl->size == rl->capacity) {
+        rl->capacity = rl->capacity ? rl->capacity * 2 : HE_SCAN_THRESHOLD;
+        rl->list = realloc(rl->list, rl->capacity * sizeof(uintptr_t));
+        assert(rl->list);
+    }
+    rl->list[rl->size++] = ptr;
+
+    if (++thi->nr_retire % HE_ERA_FREQ == 0)
+        atomic_fetch_add_explicit(&he->era, 1, memory_order_acq_rel);
+
+    if (rl->size >= rl->next_scan) {
+        __he_scan(he, rl);
+        rl->next_scan = rl->size + HE_SCAN_THRESHOLD;
+    }
+}
+
+/* The era only has to be published again when the clock has moved, which
+ * is what makes the long traversals cheap compared to the harzard pointer.
+ */
+uintptr_t he_protect_load(he_t *he, int he_index, atomic_uintptr_t *src)
+{
+    atomic_uint_fast64_t *slot = &he->thread_info[he_get_tid()].era[he_index];
+    uint64_t prev, era;
+    uintptr_t ptr;
+
+    prev = atomic_load_explicit(slot, memory_order_relaxed);
+    for (;;) {
+        ptr = atomic_load_explicit(src, memory_order_seq_cst);
+        era = atomic_load_explicit(&he->era, memory_order_acquire);
+        if (era == prev)
+            return ptr;
+        atomic_store_explicit(slot, era, memory_order_seq_cst);
+        prev = era;
+    }
+}
+
+void he_clear_local(he_t *he)
+{
+    he_th_info_t *thi = &he->thread_info[he_get_tid()];
+    int k;
+
+    for (k = 0; k < HE_MAX_ERA; k++)
+        atomic_store_explicit(&thi->era[k], HE_ERA_NONE, memory_order_release);
+}
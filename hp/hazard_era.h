@@ -0,0 +1,47 @@
+/*
+ * hazard eras: The era-based sibling of the harzard pointer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+#ifndef __HAZARD_ERA_H__
+#define __HAZARD_ERA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Hazard eras (Ramalhete and Correia) publish the era of the global clock
+ * instead of the pointer, so a reader only stores and fences when the era
+ * changes, not per node it traverses. An object is reclaimed when no
+ * published era falls in its lifetime [birth, retire].
+ *
+ * The surface follows hp_t. The objects have to come from he_alloc() which
+ * records the birth era in front of them; delete_func releases them with
+ * he_free(). The thread slots are shared with the harzard pointer, the
+ * retire list of a leaving thread stays with its slot for the next owner.
+ */
+
+typedef struct he_struct he_t;
+
+he_t *he_new(void (*delete_func)(void *));
+void he_destory(he_t *he);
+void *he_alloc(he_t *he, size_t size);
+void he_free(void *ptr);
+void he_retirelist(he_t *he, uintptr_t ptr);
+uintptr_t he_protect_load(he_t *he, int he_index, atomic_uintptr_t *src);
+void he_clear_local(he_t *he);
+
+#endif /* __HAZARD_ERA_H__ */
@@ -0,0 +1,228 @@
+/*
+ * lock-free containers: Treiber stack and Michael-Scott queue on harzard pointer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "hp_container.h"
+
+#define COHERENCE_PAD 128
+
+HP_DEFINE4(top, head, next, tail);
+
+/* The shared pointers are atomic_uintptr_t for hp_protect_load(). */
+#define ptr_load(p, order) ((void *)atomic_load_explicit((p), (order)))
+#define ptr_cas(p, old, new, succ, fail)                                  \
+    ({                                                                    \
+        uintptr_t __old = (uintptr_t)(old);                               \
+        atomic_compare_exchange_strong_explicit((p), &__old,              \
+                                                (uintptr_t)(new), (succ), \
+                                                (fail));                  \
+    })
+
+/* Treiber stack */
+
+struct hp_stack_node {
+    void *value;
+    struct hp_stack_node *next;
+};
+
+struct hp_stack {
+    alignas(COHERENCE_PAD) atomic_uintptr_t top;
+    hp_t *hp;
+};
+
+hp_stack_t *hp_stack_new(void)
+{
+    hp_stack_t *stack = aligned_alloc(COHERENCE_PAD, sizeof(hp_stack_t));
+
+    assert(stack);
+    atomic_init(&stack->top, 0);
+    stack->hp = hp_new(free);
+
+    return stack;
+}
+
+void hp_stack_destory(hp_stack_t *stack)
+{
+    struct hp_stack_node *node, *tmp;
+
+    for (node = ptr_load(&stack->top, memory_order_relaxed); node; node = tmp) {
+        tmp = node->next;
+        free(node);
+    }
+    hp_destory(stack->hp);
+    free(stack);
+}
+
+void hp_stack_push(hp_stack_t *stack, void *value)
+{
+    struct hp_stack_node *node = malloc(sizeof(struct hp_stack_node));
+    uintptr_t top;
+
+    assert(node);
+    node->value = value;
+    top = atomic_load_explicit(&stack->top, memory_order_relaxed);
+    do {
+        node->next = (struct hp_stack_node *)top;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &stack->top, &top, (uintptr_t)node, memory_order_release,
+        memory_order_relaxed));
+}
+
+void *hp_stack_pop(hp_stack_t *stack)
+{
+    struct hp_stack_node *top, *next;
+    void *value;
+
+    for (;;) {
+        top = (struct hp_stack_node *)hp_protect_load(stack->hp, HP_top,
+                                                      &stack->top);
+        if (!top)
+            return NULL;
+        /* top can not be freed, and the harzard pointer avoids ABA. */
+        next = top->next;
+        if (ptr_cas(&stack->top, top, next, memory_order_acq_rel,
+                    memory_order_relaxed))
+            break;
+    }
+
+    value = top->value;
+    hp_clear_local(stack->hp);
+    hp_retirelist(stack->hp, (uintptr_t)top);
+
+    return value;
+}
+
+/* Michael-Scott queue, head always points to a dummy node. */
+
+struct hp_queue_node {
+    void *value;
+    _Atomic(struct hp_queue_node *) next;
+};
+
+struct hp_queue {
+    alignas(COHERENCE_PAD) atomic_uintptr_t head;
+    alignas(COHERENCE_PAD) atomic_uintptr_t tail;
+    hp_t *hp;
+};
+
+static struct hp_queue_node *hp_queue_node_new(void *value)
+{
+    struct hp_queue_node *node = malloc(sizeof(struct hp_queue_node));
+
+    assert(node);
+    node->value = value;
+    atomic_init(&node->next, NULL);
+
+    return node;
+}
+
+hp_queue_t *hp_queue_new(void)
+{
+    hp_queue_t *queue = aligned_alloc(COHERENCE_PAD, sizeof(hp_queue_t));
+    struct hp_queue_node *dummy = hp_queue_node_new(NULL);
+
+    assert(queue);
+    atomic_init(&queue->head, (uintptr_t)dummy);
+    atomic_init(&queue->tail, (uintptr_t)dummy);
+    queue->hp = hp_new(free);
+
+    return queue;
+}
+
+void hp_queue_destory(hp_queue_t *queue)
+{
+    struct hp_queue_node *node, *tmp;
+
+    for (node = ptr_load(&queue->head, memory_order_relaxed); node; node = tmp) {
+        tmp = atomic_load(&node->next);
+        free(node);
+    }
+    hp_destory(queue->hp);
+    free(queue);
+}
+
+void hp_queue_enqueue(hp_queue_t *queue, void *value)
+{
+    struct hp_queue_node *node = hp_queue_node_new(value);
+    struct hp_queue_node *tail, *next;
+
+    for (;;) {
+        tail = (struct hp_queue_node *)hp_protect_load(queue->hp, HP_tail,
+                                                       &queue->tail);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (next) {
+            /* The tail is falling behind, help to swing it. */
+            ptr_cas(&queue->tail, tail, next, memory_order_release,
+                    memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_strong_explicit(&tail->next, &next, node,
+                                                    memory_order_release,
+                                                    memory_order_relaxed))
+            break;
+    }
+
+    ptr_cas(&queue->tail, tail, node, memory_order_release,
+            memory_order_relaxed);
+    hp_clear_local(queue->hp);
+}
+
+void *hp_queue_dequeue(hp_queue_t *queue)
+{
+    struct hp_queue_node *head, *tail, *next;
+    void *value;
+
+    for (;;) {
+        head = (struct hp_queue_node *)hp_protect_load(queue->hp, HP_head,
+                                                       &queue->head);
+        tail = ptr_load(&queue->tail, memory_order_acquire);
+        next = atomic_load_explicit(&head->next, memory_order_acquire);
+        /* head->next never changes once set, validate next against the
+         * queue head instead, so it can not have been dequeued.
+         */
+        hp_protect_release(queue->hp, HP_next, (uintptr_t)next);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (head != ptr_load(&queue->head, memory_order_acquire))
+            continue;
+        if (!next) {
+            hp_clear_local(queue->hp);
+            return NULL;
+        }
+        if (head == tail) {
+            ptr_cas(&queue->tail, tail, next, memory_order_release,
+                    memory_order_relaxed);
+            continue;
+        }
+        /* Read the value before the other dequeuer can retire next. */
+        value = next->value;
+        if (ptr_cas(&queue->head, head, next, memory_order_acq_rel,
+                    memory_order_relaxed))
+            break;
+    }
+
+    hp_clear_local(queue->hp);
+    hp_retirelist(queue->hp, (uintptr_t)head);
+
+    return value;
+}
@@ -0,0 +1,43 @@
+/*
+ * lock-free containers: Treiber stack and Michael-Scott queue on harzard pointer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+#ifndef __HP_CONTAINER_H__
+#define __HP_CONTAINER_H__
+
+#include "harzard_pointer.h"
+
+/* The nodes are reclaimed by the harzard pointer of each container, the
+ * values are owned by the caller. Both of pop and dequeue return NULL when
+ * the container is empty, so NULL can not be stored.
+ */
+
+typedef struct hp_stack hp_stack_t;
+
+hp_stack_t *hp_stack_new(void);
+void hp_stack_destory(hp_stack_t *stack);
+void hp_stack_push(hp_stack_t *stack, void *value);
+void *hp_stack_pop(hp_stack_t *stack);
+
+typedef struct hp_queue hp_queue_t;
+
+hp_queue_t *hp_queue_new(void);
+void hp_queue_destory(hp_queue_t *queue);
+void hp_queue_enqueue(hp_queue_t *queue, void *value);
+void *hp_queue_dequeue(hp_queue_t *queue);
+
+#endif /* __HP_CONTAINER_H__ */
@@ -17,13 +17,103 @@
  * Copyright (C) 2021 linD026
  */
 
-#include "hazard_pointer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "harzard_pointer.h"
 
 HP_DEFINE4(first, second, third, fourth);
 
-int main(void)
+#ifndef THREAD_NUM
+#define THREAD_NUM 4
+#endif
+
+#ifndef RETIRE_NUM
+#define RETIRE_NUM 100000
+#endif
+
+struct test {
+    int count;
+};
+
+static hp_t *hp;
+
+static void test_free(void *ptr)
+{
+    free(ptr);
+}
+
+/* Each thread keeps all of its hazard pointers published, so the scan
+ * always sees THREAD_NUM * 4 hazards. Every new object replaces the oldest
+ * protected one, which is retired afterward.
+ */
+static void *retire_side(void *argv)
+{
+    uintptr_t protected[4] = { 0 };
+    struct test *obj;
+    int i, idx;
+
+    hp_thread_register();
+
+    for (i = 0; i < RETIRE_NUM; i++) {
+        idx = i & 0x3;
+        obj = (struct test *)malloc(sizeof(struct test));
+        obj->count = i;
+        hp_protect_release(hp, idx, (uintptr_t)obj);
+        if (protected[idx])
+            hp_retirelist(hp, protected[idx]);
+        protected[idx] = (uintptr_t)obj;
+    }
+
+    for (idx = HP_first; idx <= HP_fourth; idx++) {
+        hp_protect_release(hp, idx, 0);
+        hp_retirelist(hp, protected[idx]);
+    }
+
+    hp_thread_unregister();
+
+    pthread_exit(NULL);
+}
+
+static double benchmark(int mode)
+{
+    pthread_t thread[THREAD_NUM];
+    struct timespec start, end;
+    struct hp_stat stat;
+    double during;
+    int i;
+
+    hp = hp_new(test_free);
+    hp_scan_mode(hp, mode, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < THREAD_NUM; i++)
+        pthread_create(&thread[i], NULL, retire_side, NULL);
+
+    for (i = 0; i < THREAD_NUM; i++)
+        pthread_join(thread[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    hp_stat(hp, &stat);
+    hp_destory(hp);
+
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("[%s] peak retire list depth %zu, back-pressure %zu\n",
+           mode == HP_SCAN_LINEAR ? "linear" : "snapshot", stat.peak_depth,
+           stat.nr_backpressure);
+    return (double)THREAD_NUM * RETIRE_NUM / during;
+}
+
+int main(int argc, char *argv[])
 {
-    hp_t *hp = hp_new(0);
-    hp_protect_clear(hp);
+    printf("hp retire throughput: thread %d, retire %d\n", THREAD_NUM,
+           RETIRE_NUM);
+    printf("linear scan:   %.0f retires/sec\n", benchmark(HP_SCAN_LINEAR));
+    printf("snapshot scan: %.0f retires/sec\n", benchmark(HP_SCAN_SNAPSHOT));
     return 0;
 }
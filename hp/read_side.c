@@ -0,0 +1,158 @@
+/*
+ * harzard pointer: A read side benchmark of the protect operations
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "harzard_pointer.h"
+
+HP_DEFINE4(first, second, third, fourth);
+
+#ifndef THREAD_NUM
+#define THREAD_NUM 4
+#endif
+
+#ifndef READ_NUM
+#define READ_NUM 10000000
+#endif
+
+struct test {
+    int count;
+};
+
+static hp_t *hp;
+static atomic_uintptr_t foo;
+
+/* hp_protect_release() only, which is what the callers do today but it
+ * is not safe without the fence.
+ */
+static inline struct test *read_release(void)
+{
+    uintptr_t ptr = atomic_load_explicit(&foo, memory_order_acquire);
+
+    hp_protect_release(hp, HP_first, ptr);
+    return (struct test *)ptr;
+}
+
+/* The hand-rolled validation: release store, full fence and reload. */
+static inline struct test *read_fence(void)
+{
+    uintptr_t ptr, tmp = atomic_load_explicit(&foo, memory_order_acquire);
+
+    do {
+        ptr = tmp;
+        hp_protect_release(hp, HP_first, ptr);
+        atomic_thread_fence(memory_order_seq_cst);
+        tmp = atomic_load_explicit(&foo, memory_order_acquire);
+    } while (tmp != ptr);
+
+    return (struct test *)ptr;
+}
+
+static inline struct test *read_load(void)
+{
+    return (struct test *)hp_protect_load(hp, HP_first, &foo);
+}
+
+static struct test *(*const read_ops[])(void) = {
+    read_release,
+    read_fence,
+    read_load,
+};
+
+static const char *read_name[] = {
+    "hp_protect_release",
+    "release + fence",
+    "hp_protect_load",
+};
+
+static int read_type;
+static atomic_long sum;
+static atomic_long total_ns;
+
+static void *reader_side(void *argv)
+{
+    struct test *(*read)(void) = read_ops[read_type];
+    struct timespec start, end;
+    long count = 0;
+    int i;
+
+    hp_thread_register();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < READ_NUM; i++) {
+        count += read()->count;
+        hp_clear_local(hp);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    atomic_fetch_add(&sum, count);
+    atomic_fetch_add(&total_ns, (end.tv_sec - start.tv_sec) * 1000000000L +
+                                    (end.tv_nsec - start.tv_nsec));
+
+    hp_thread_unregister();
+    pthread_exit(NULL);
+}
+
+static void benchmark(int type)
+{
+    pthread_t reader[THREAD_NUM];
+    int i;
+
+    read_type = type;
+    atomic_store(&total_ns, 0);
+
+    for (i = 0; i < THREAD_NUM; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+
+    for (i = 0; i < THREAD_NUM; i++)
+        pthread_join(reader[i], NULL);
+
+    /* The read and the clear of the harzard pointer per op */
+    printf("%-28s: %.2f ns/op\n", read_name[type],
+           (double)atomic_load(&total_ns) / ((double)THREAD_NUM * READ_NUM));
+}
+
+int main(int argc, char *argv[])
+{
+    struct test *obj = malloc(sizeof(struct test));
+
+    obj->count = 1;
+    atomic_init(&foo, (uintptr_t)obj);
+    hp = hp_new(free);
+
+    printf("hp read side: reader %d, read %d\n", THREAD_NUM, READ_NUM);
+    benchmark(0);
+    benchmark(1);
+    benchmark(2);
+    if (hp_membarrier_enable()) {
+        printf("membarrier is not supported\n");
+    } else {
+        read_name[2] = "hp_protect_load (membarrier)";
+        benchmark(2);
+    }
+
+    hp_destory(hp);
+    free(obj);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * harzard pointer: A benchmark of the retire latency, sync vs async
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "harzard_pointer.h"
+
+HP_DEFINE4(first, second, third, fourth);
+
+#ifndef THREAD_NUM
+#define THREAD_NUM 4
+#endif
+
+#ifndef RETIRE_NUM
+#define RETIRE_NUM 100000
+#endif
+
+struct test {
+    int count;
+};
+
+static hp_t *hp;
+static long *latency;
+
+static void test_free(void *ptr)
+{
+    free(ptr);
+}
+
+static inline long time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Same access pattern as main.c, but time every hp_retirelist(). */
+static void *retire_side(void *argv)
+{
+    long *lat = &latency[(intptr_t)argv * RETIRE_NUM];
+    uintptr_t protected[4] = { 0 };
+    struct test *obj;
+    long start;
+    int i, idx;
+
+    hp_thread_register();
+
+    for (i = 0; i < RETIRE_NUM; i++) {
+        idx = i & 0x3;
+        obj = (struct test *)malloc(sizeof(struct test));
+        obj->count = i;
+        hp_protect_release(hp, idx, (uintptr_t)obj);
+        start = time_ns();
+        if (protected[idx])
+            hp_retirelist(hp, protected[idx]);
+        lat[i] = time_ns() - start;
+        protected[idx] = (uintptr_t)obj;
+    }
+
+    for (idx = HP_first; idx <= HP_fourth; idx++) {
+        hp_protect_release(hp, idx, 0);
+        hp_retirelist(hp, protected[idx]);
+    }
+
+    hp_thread_unregister();
+
+    pthread_exit(NULL);
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void benchmark(int async)
+{
+    pthread_t thread[THREAD_NUM];
+    size_t nr = (size_t)THREAD_NUM * RETIRE_NUM;
+    long start, during;
+    intptr_t i;
+
+    hp = hp_new(test_free);
+    if (async && hp_reclaimer_start(hp)) {
+        fprintf(stderr, "hp_reclaimer_start failed\n");
+        abort();
+    }
+
+    start = time_ns();
+
+    for (i = 0; i < THREAD_NUM; i++)
+        pthread_create(&thread[i], NULL, retire_side, (void *)i);
+
+    for (i = 0; i < THREAD_NUM; i++)
+        pthread_join(thread[i], NULL);
+
+    during = time_ns() - start;
+
+    hp_reclaimer_flush(hp);
+    hp_destory(hp);
+
+    qsort(latency, nr, sizeof(long), cmp_long);
+    printf("%-5s: p50 %ld ns, p99 %ld ns, p99.9 %ld ns, max %ld ns, "
+           "%.0f retires/sec\n",
+           async ? "async" : "sync", latency[nr / 2], latency[nr * 99 / 100],
+           latency[nr * 999 / 1000], latency[nr - 1], nr * 1e9 / during);
+}
+
+int main(int argc, char *argv[])
+{
+    latency = malloc(sizeof(long) * THREAD_NUM * RETIRE_NUM);
+    if (!latency) {
+        fprintf(stderr, "latency: malloc failed\n");
+        abort();
+    }
+
+    printf("hp retire latency: thread %d, retire %d\n", THREAD_NUM,
+           RETIRE_NUM);
+    benchmark(0);
+    benchmark(1);
+
+    free(latency);
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * safe memory reclamation: Switch between harzard pointer and hazard eras
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+#ifndef __SMR_H__
+#define __SMR_H__
+
+/* The data structures use the smr_* names and pick the scheme at compile
+ * time, the harzard pointer by default or the hazard eras with
+ * CONFIG_HAZARD_ERA. The objects come from smr_alloc() and delete_func
+ * releases them with smr_free().
+ */
+
+#include <stdlib.h>
+
+#include "harzard_pointer.h"
+
+#if defined(CONFIG_HAZARD_ERA)
+#include "hazard_era.h"
+
+typedef he_t smr_t;
+
+#define SMR_NAME "hazard era"
+#define smr_new(delete_func) he_new(delete_func)
+#define smr_destory(smr) he_destory(smr)
+#define smr_alloc(smr, size) he_alloc((smr), (size))
+#define smr_free(ptr) he_free(ptr)
+#define smr_retire(smr, ptr) he_retirelist((smr), (uintptr_t)(ptr))
+#define smr_protect_load(smr, idx, src) he_protect_load((smr), (idx), (src))
+#define smr_clear_local(smr) he_clear_local(smr)
+#else
+typedef hp_t smr_t;
+
+#define SMR_NAME "harzard pointer"
+#define smr_new(delete_func) hp_new(delete_func)
+#define smr_destory(smr) hp_destory(smr)
+#define smr_alloc(smr, size) malloc(size)
+#define smr_free(ptr) free(ptr)
+#define smr_retire(smr, ptr) hp_retirelist((smr), (uintptr_t)(ptr))
+#define smr_protect_load(smr, idx, src) hp_protect_load((smr), (idx), (src))
+#define smr_clear_local(smr) hp_clear_local(smr)
+#endif
+
+#endif /* __SMR_H__ */
@@ -0,0 +1,213 @@
+/*
+ * lock-free containers: A MPMC benchmark against the pthread mutex
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "hp_container.h"
+
+#ifndef PRODUCER_NUM
+#define PRODUCER_NUM 4
+#endif
+
+#ifndef CONSUMER_NUM
+#define CONSUMER_NUM 4
+#endif
+
+#ifndef OPS_NUM
+#define OPS_NUM 100000
+#endif
+
+/* The baseline: a linked list under the pthread mutex, LIFO or FIFO. */
+
+struct mutex_node {
+    void *value;
+    struct mutex_node *next;
+};
+
+struct mutex_list {
+    pthread_mutex_t lock;
+    struct mutex_node *head, *tail;
+};
+
+static void mutex_push(struct mutex_list *list, void *value, int fifo)
+{
+    struct mutex_node *node = malloc(sizeof(struct mutex_node));
+
+    node->value = value;
+    node->next = NULL;
+    pthread_mutex_lock(&list->lock);
+    if (!list->head) {
+        list->head = list->tail = node;
+    } else if (fifo) {
+        list->tail->next = node;
+        list->tail = node;
+    } else {
+        node->next = list->head;
+        list->head = node;
+    }
+    pthread_mutex_unlock(&list->lock);
+}
+
+static void *mutex_pop(struct mutex_list *list)
+{
+    struct mutex_node *node;
+    void *value = NULL;
+
+    pthread_mutex_lock(&list->lock);
+    node = list->head;
+    if (node) {
+        list->head = node->next;
+        if (!list->head)
+            list->tail = NULL;
+    }
+    pthread_mutex_unlock(&list->lock);
+
+    if (node) {
+        value = node->value;
+        free(node);
+    }
+    return value;
+}
+
+enum { HP_STACK, HP_QUEUE, MUTEX_STACK, MUTEX_QUEUE };
+
+static const char *const bench_name[] = {
+    [HP_STACK] = "hp stack",
+    [HP_QUEUE] = "hp queue",
+    [MUTEX_STACK] = "mutex stack",
+    [MUTEX_QUEUE] = "mutex queue",
+};
+
+static int bench_type;
+static hp_stack_t *stack;
+static hp_queue_t *queue;
+static struct mutex_list list = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static atomic_long consumed;
+static atomic_long checksum;
+
+static void put(void *value)
+{
+    switch (bench_type) {
+    case HP_STACK:
+        hp_stack_push(stack, value);
+        break;
+    case HP_QUEUE:
+        hp_queue_enqueue(queue, value);
+        break;
+    default:
+        mutex_push(&list, value, bench_type == MUTEX_QUEUE);
+    }
+}
+
+static void *get(void)
+{
+    switch (bench_type) {
+    case HP_STACK:
+        return hp_stack_pop(stack);
+    case HP_QUEUE:
+        return hp_queue_dequeue(queue);
+    default:
+        return mutex_pop(&list);
+    }
+}
+
+static void *producer(void *argv)
+{
+    intptr_t i;
+
+    for (i = 1; i <= OPS_NUM; i++)
+        put((void *)i);
+
+    hp_thread_unregister();
+    pthread_exit(NULL);
+}
+
+static void *consumer(void *argv)
+{
+    long total = (long)PRODUCER_NUM * OPS_NUM;
+    long sum = 0;
+    void *value;
+
+    while (atomic_load_explicit(&consumed, memory_order_relaxed) < total) {
+        value = get();
+        if (!value) {
+            sched_yield();
+            continue;
+        }
+        sum += (intptr_t)value;
+        atomic_fetch_add_explicit(&consumed, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add(&checksum, sum);
+
+    hp_thread_unregister();
+    pthread_exit(NULL);
+}
+
+static void benchmark(int type)
+{
+    pthread_t thread[PRODUCER_NUM + CONSUMER_NUM];
+    struct timespec start, end;
+    long expect = (long)PRODUCER_NUM * OPS_NUM * (OPS_NUM + 1) / 2;
+    double during;
+    int i;
+
+    bench_type = type;
+    stack = hp_stack_new();
+    queue = hp_queue_new();
+    atomic_store(&consumed, 0);
+    atomic_store(&checksum, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < PRODUCER_NUM; i++)
+        pthread_create(&thread[i], NULL, producer, NULL);
+    for (i = PRODUCER_NUM; i < PRODUCER_NUM + CONSUMER_NUM; i++)
+        pthread_create(&thread[i], NULL, consumer, NULL);
+
+    for (i = 0; i < PRODUCER_NUM + CONSUMER_NUM; i++)
+        pthread_join(thread[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    hp_stack_destory(stack);
+    hp_queue_destory(queue);
+
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-12s: %.0f ops/sec%s\n", bench_name[type],
+           2.0 * PRODUCER_NUM * OPS_NUM / during,
+           atomic_load(&checksum) == expect ? "" : " (checksum mismatch)");
+}
+
+int main(int argc, char *argv[])
+{
+    printf("container MPMC: producer %d, consumer %d, ops %d\n", PRODUCER_NUM,
+           CONSUMER_NUM, OPS_NUM);
+    benchmark(HP_STACK);
+    benchmark(MUTEX_STACK);
+    benchmark(HP_QUEUE);
+    benchmark(MUTEX_QUEUE);
+    return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * safe memory reclamation: A linked list traversal under HP, HE and thrd-RCU
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Copyright (C) 2021 linD026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+
+#if defined(CONFIG_THRD_RCU)
+#include "../rcu/thrd-based-rcu/thrd_rcu.h"
+#define SMR_NAME "thrd rcu"
+#else
+#include "smr.h"
+#endif
+
+#ifndef READER_NUM
+#define READER_NUM 4
+#endif
+
+#ifndef LIST_LEN
+#define LIST_LEN 1000
+#endif
+
+#ifndef UPDATE_NUM
+#define UPDATE_NUM 100000
+#endif
+
+/* thrd-RCU frees the replaced nodes after one grace period per batch. */
+#define RCU_BATCH 64
+
+/* The low bit of next marks the node as removed, its next is frozen. */
+#define NODE_MARK 0x1UL
+
+struct node {
+    long value;
+    atomic_uintptr_t next;
+};
+
+static atomic_uintptr_t head;
+static atomic_bool stop;
+static atomic_long nr_alive;
+static atomic_long nr_traverse;
+static atomic_long nr_broken;
+
+#define node_of(ptr) ((struct node *)((ptr) & ~NODE_MARK))
+
+#if defined(CONFIG_THRD_RCU)
+
+static struct node *node_alloc(void)
+{
+    atomic_fetch_add_explicit(&nr_alive, 1, memory_order_relaxed);
+    return malloc(sizeof(struct node));
+}
+
+static void node_free(void *ptr)
+{
+    atomic_fetch_sub_explicit(&nr_alive, 1, memory_order_relaxed);
+    free(ptr);
+}
+
+static long traverse(void)
+{
+    uintptr_t cur;
+    long sum = 0;
+
+    rcu_read_lock();
+    for (cur = atomic_load_explicit(&head, memory_order_acquire); node_of(cur);
+         cur = atomic_load_explicit(&node_of(cur)->next, memory_order_acquire))
+        sum += node_of(cur)->value;
+    rcu_read_unlock();
+
+    return sum;
+}
+
+static struct node *pending[RCU_BATCH];
+static int nr_pending;
+
+static void node_retire(struct node *node)
+{
+    int i;
+
+    pending[nr_pending++] = node;
+    if (nr_pending < RCU_BATCH)
+        return;
+
+    synchronize_rcu();
+    for (i = 0; i < nr_pending; i++)
+        node_free(pending[i]);
+    nr_pending = 0;
+}
+
+static void reader_init(void)
+{
+    rcu_init();
+}
+
+static void reader_exit(void)
+{
+}
+
+static void list_init(void)
+{
+}
+
+static void list_exit(void)
+{
+    synchronize_rcu();
+    while (nr_pending)
+        node_free(pending[--nr_pending]);
+    rcu_clean();
+}
+
+#else /* !CONFIG_THRD_RCU */
+
+static smr_t *smr;
+
+static struct node *node_alloc(void)
+{
+    atomic_fetch_add_explicit(&nr_alive, 1, memory_order_relaxed);
+    return smr_alloc(smr, sizeof(struct node));
+}
+
+static void node_free(void *ptr)
+{
+    atomic_fetch_sub_explicit(&nr_alive, 1, memory_order_relaxed);
+    smr_free(ptr);
+}
+
+/* Hand-over-hand: the current node stays protected in one slot while the
+ * next one is protected in the other slot.
+ */
+static long traverse(void)
+{
+    atomic_uintptr_t *prev;
+    uintptr_t cur;
+    long sum;
+    int idx;
+
+retry:
+    sum = 0;
+    idx = 0;
+    prev = &head;
+    for (;;) {
+        cur = smr_protect_load(smr, idx, prev);
+        if (cur & NODE_MARK)
+            goto retry;
+        if (!cur)
+            break;
+        sum += node_of(cur)->value;
+        prev = &node_of(cur)->next;
+        idx ^= 1;
+    }
+    smr_clear_local(smr);
+
+    return sum;
+}
+
+static void node_retire(struct node *node)
+{
+    smr_retire(smr, node);
+}
+
+static void reader_init(void)
+{
+    hp_thread_register();
+}
+
+static void reader_exit(void)
+{
+    smr_clear_local(smr);
+    hp_thread_unregister();
+}
+
+static void list_init(void)
+{
+    smr = smr_new(node_free);
+}
+
+static void list_exit(void)
+{
+    smr_destory(smr);
+}
+
+#endif /* CONFIG_THRD_RCU */
+
+/* The replacement keeps the value, so every traversal sums the same. */
+static void *updater_side(void *argv)
+{
+    atomic_uintptr_t *prev;
+    struct node *old, *new;
+    uintptr_t next;
+    long peak = 0, alive;
+    int i, k;
+
+    for (i = 0; i < UPDATE_NUM; i++) {
+        prev = &head;
+        for (k = rand() % LIST_LEN; k; k--)
+            prev = &node_of(atomic_load(prev))->next;
+        old = node_of(atomic_load(prev));
+
+        new = node_alloc();
+        new->value = old->value;
+        next = atomic_fetch_or(&old->next, NODE_MARK);
+        atomic_init(&new->next, next);
+        atomic_store_explicit(prev, (uintptr_t)new, memory_order_release);
+        node_retire(old);
+
+        alive = atomic_load_explicit(&nr_alive, memory_order_relaxed);
+        if (alive > peak)
+            peak = alive;
+    }
+    atomic_store(&stop, true);
+
+    return (void *)(intptr_t)(peak - LIST_LEN);
+}
+
+static void *reader_side(void *argv)
+{
+    long expect = (long)LIST_LEN * (LIST_LEN - 1) / 2;
+    long count = 0;
+
+    reader_init();
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        if (traverse() != expect)
+            atomic_fetch_add(&nr_broken, 1);
+        count++;
+    }
+    atomic_fetch_add(&nr_traverse, count);
+
+    reader_exit();
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t reader[READER_NUM], updater;
+    struct timespec start, end;
+    struct node *node;
+    uintptr_t next;
+    void *peak;
+    double during;
+    int i;
+
+    list_init();
+    for (i = LIST_LEN - 1; i >= 0; i--) {
+        node = node_alloc();
+        node->value = i;
+        atomic_init(&node->next, atomic_load(&head));
+        atomic_store(&head, (uintptr_t)node);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < READER_NUM; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+    pthread_create(&updater, NULL, updater_side, NULL);
+
+    pthread_join(updater, &peak);
+    for (i = 0; i < READER_NUM; i++)
+        pthread_join(reader[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s traverse: reader %d, list %d, update %d\n", SMR_NAME,
+           READER_NUM, LIST_LEN, UPDATE_NUM);
+    printf("read: %.0f nodes/sec, %ld broken traversal\n",
+           (double)atomic_load(&nr_traverse) * LIST_LEN / during,
+           atomic_load(&nr_broken));
+    printf("memory: peak %ld unreclaimed nodes\n", (long)(intptr_t)peak);
+
+    for (next = atomic_load(&head); node_of(next);) {
+        node = node_of(next);
+        next = atomic_load(&node->next);
+        node_free(node);
+    }
+    list_exit();
+
+    return 0;
+}
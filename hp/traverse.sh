@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+
+for SMR in hp he rcu; do
+    make -C $(dirname $0) traverse CONFIG_SMR=$SMR
+    $(dirname $0)/test
+    echo "-------------------------"
+done
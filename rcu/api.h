@@ -53,6 +53,12 @@ static __inline__ void spin_lock(spinlock_t *sp)
     }
 }
 
+/* return 1 if the lock is taken */
+static __inline__ int spin_trylock(spinlock_t *sp)
+{
+    return pthread_mutex_trylock(sp) == 0;
+}
+
 static __inline__ void spin_unlock(spinlock_t *sp)
 {
     int ret;
@@ -80,4 +86,33 @@ static __inline__ void spin_unlock(spinlock_t *sp)
 
 #define current_tid() (unsigned int)pthread_self()
 
+/* asymmetric fence: membarrier(2) forces the full fence on every running
+ * thread of this process, so the other side only needs barrier().
+ */
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+
+/* return 0 if membarrier can be used by this process */
+static __inline__ int membarrier_register(void)
+{
+    long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+
+    if (cmds < 0 || !(cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED))
+        return -1;
+    if (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0,
+                0))
+        return -1;
+    return 0;
+}
+
+static __inline__ void membarrier(void)
+{
+    if (syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0)) {
+        fprintf(stderr, "membarrier:MEMBARRIER_CMD_PRIVATE_EXPEDITED\n");
+        abort();
+    }
+}
+
 #endif /* __RCU_COMMON_API_H__ */
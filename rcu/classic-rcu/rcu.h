@@ -26,6 +26,12 @@
 #include <linux/cpumask.h>
 #include <linux/sched.h>
 #include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+#include <linux/delay.h>
+
+#include "trace_time.h"
 
 #ifdef __CHECKER__
 #define __lrcu __attribute__((noderef, address_space(__lrcu)))
@@ -35,50 +41,95 @@
 #define lrcu_check_sparse(p, space)
 #endif /* __CHECKER__ */
 
+/* The initial size of the retired pointer list, it doubles until it
+ * reaches LRCU_LIST_MAX. lrcu_assign_pointer() fails when it is full.
+ */
 #define NR_LRCU_PROTECTED 10
+#define LRCU_LIST_MAX 1024
 
 typedef void (*lrcu_callback_t)(void *);
 
+/* call_lrcu() only counts the request, the worker serves all the requests
+ * pending with one grace period and passes the pointers retired before it
+ * to the callback.
+ */
 struct lrcu_data {
-    void __lrcu *list[NR_LRCU_PROTECTED];
+    void __lrcu **list;
+    unsigned int nr;
+    unsigned int size;
     spinlock_t list_lock;
+    /* Only the worker uses it, the callbacks run on it without the lock. */
+    void **batch;
+    unsigned int batch_size;
     lrcu_callback_t callback;
+    struct task_struct *worker;
+    wait_queue_head_t wait;
+    unsigned long nr_req;
+    unsigned long nr_done;
+    unsigned long nr_gp;
+    unsigned long nr_cb;
+    struct trace_time trace;
 };
 
+static int __lrcu_worker(void *data);
+
 static __inline__ struct lrcu_data *lrcu_data_init(lrcu_callback_t cb)
 {
     struct lrcu_data *ldp = kmalloc(sizeof(struct lrcu_data), GFP_KERNEL);
     if (!ldp)
         return NULL;
+    ldp->list = kmalloc_array(NR_LRCU_PROTECTED, sizeof(void *), GFP_KERNEL);
+    if (!ldp->list) {
+        kfree(ldp);
+        return NULL;
+    }
+    ldp->nr = 0;
+    ldp->size = NR_LRCU_PROTECTED;
     spin_lock_init(&ldp->list_lock);
+    ldp->batch = NULL;
+    ldp->batch_size = 0;
     ldp->callback = cb;
+    init_waitqueue_head(&ldp->wait);
+    ldp->nr_req = 0;
+    ldp->nr_done = 0;
+    ldp->nr_gp = 0;
+    ldp->nr_cb = 0;
+    ldp->trace = TRACE_TIME_INIT("lrcu batch");
+
+    ldp->worker = kthread_run(__lrcu_worker, (void *)ldp, "kthread: lrcu");
+    if (IS_ERR(ldp->worker)) {
+        kfree(ldp->list);
+        kfree(ldp);
+        return NULL;
+    }
+
     return ldp;
 }
 
 static __inline__ void *__lrcu_collect_old_pointer(struct lrcu_data *lrcu_data,
                                                    void __lrcu *oldp)
 {
-    int i, idx = -1;
+    void __lrcu **list;
 
     spin_lock(&lrcu_data->list_lock);
 
-    for (i = 0; i < NR_LRCU_PROTECTED; i++) {
-        if (lrcu_data->list[i] == NULL) {
-            idx = i;
-            break;
+    if (lrcu_data->nr == lrcu_data->size) {
+        list = NULL;
+        if (lrcu_data->size < LRCU_LIST_MAX)
+            list = krealloc(lrcu_data->list,
+                            sizeof(void *) * lrcu_data->size * 2, GFP_ATOMIC);
+        if (!list) {
+            pr_alert("lrcu_assign_pointer:"
+                     "__lrcu_collect_old_pointer - buffer is full\n");
+            return NULL;
         }
-        barrier();
-    }
-
-    if (idx == -1) {
-        pr_alert("lrcu_assign_pointer:"
-                 "__lrcu_collect_old_pointer - buffer is full\n");
-        return NULL;
+        lrcu_data->list = list;
+        lrcu_data->size *= 2;
     }
 
-    lrcu_data->list[idx] = READ_ONCE(oldp);
+    lrcu_data->list[lrcu_data->nr++] = READ_ONCE(oldp);
 
-    return (void __force *)lrcu_data->list[idx];
+    return (void __force *)lrcu_data->list[lrcu_data->nr - 1];
 }
 
 /* lrcu_assign_pointer() - assign to LRCU-protected pointer
@@ -145,53 +196,159 @@ static __inline__ int lrcu_sched_init(void)
 
 #define run_on(cpu) lrcu_sched_setaffinity(current->pid, cpumask_of(cpu))
 
-static __inline__ void synchronize_lrcu(struct lrcu_data *lrcu_data)
+static __inline__ void __lrcu_grace_period(void)
 {
-    int cpu, i;
+    int cpu;
 
     for_each_online_cpu(cpu) run_on(cpu);
+    lrcu_sched_setaffinity(current->pid, cpu_possible_mask);
+
+    smp_mb();
+}
+
+/* Drop the first nr pointers of the list, it needs list_lock. The
+ * concurrent synchronize_lrcu() may have dropped some of them.
+ */
+static __inline__ void __lrcu_list_drop(struct lrcu_data *lrcu_data,
+                                        unsigned int nr)
+{
+    if (nr > lrcu_data->nr)
+        nr = lrcu_data->nr;
+    lrcu_data->nr -= nr;
+    memmove(lrcu_data->list, lrcu_data->list + nr,
+            sizeof(void *) * lrcu_data->nr);
+}
+
+/* The caller frees the pointer returned by lrcu_assign_pointer() itself,
+ * so do not mix it with call_lrcu() on the same lrcu_data.
+ */
+static __inline__ void synchronize_lrcu(struct lrcu_data *lrcu_data)
+{
+    unsigned int nr;
 
     smp_mb();
 
     spin_lock(&lrcu_data->list_lock);
+    nr = lrcu_data->nr;
+    spin_unlock(&lrcu_data->list_lock);
 
-    for (i = 0; i < NR_LRCU_PROTECTED; i++)
-        lrcu_data->list[i] = NULL;
+    __lrcu_grace_period();
 
+    spin_lock(&lrcu_data->list_lock);
+    __lrcu_list_drop(lrcu_data, nr);
     spin_unlock(&lrcu_data->list_lock);
 
     smp_mb();
 }
 
-static __inline__ int __call_lrcu(void *data)
+/* Serve the requests pending with one grace period. */
+static __inline__ void __lrcu_do_batch(struct lrcu_data *lrcu_data)
 {
-    struct lrcu_data *lrcu_data = (struct lrcu_data *)data;
-    int cpu, i;
-
-    for_each_online_cpu(cpu) run_on(cpu);
-
-    smp_mb();
+    unsigned long req;
+    unsigned int nr, i;
+    void **batch;
 
     spin_lock(&lrcu_data->list_lock);
+    req = lrcu_data->nr_req;
+    nr = lrcu_data->nr;
+    spin_unlock(&lrcu_data->list_lock);
+
+    if (req == READ_ONCE(lrcu_data->nr_done))
+        return;
 
-    for (i = 0; i < NR_LRCU_PROTECTED; i++) {
-        if (lrcu_data->list[i] != NULL) {
-            lrcu_data->callback((void __force *)lrcu_data->list[i]);
-            lrcu_data->list[i] = NULL;
+    if (nr > lrcu_data->batch_size) {
+        batch = krealloc(lrcu_data->batch, sizeof(void *) * nr, GFP_KERNEL);
+        if (!batch) {
+            pr_alert("__lrcu_worker: __lrcu_do_batch - krealloc failed\n");
+            /* Retry the batch later. */
+            msleep(1);
+            return;
         }
+        lrcu_data->batch = batch;
+        lrcu_data->batch_size = nr;
     }
 
+    TRACE_TIME_START(lrcu_data->trace);
+    __lrcu_grace_period();
+    TRACE_TIME_END(lrcu_data->trace);
+
+    /* Detach the pointers under the lock, the callback may assign the
+     * pointer or call call_lrcu() on the same lrcu_data.
+     */
+    spin_lock(&lrcu_data->list_lock);
+    if (nr > lrcu_data->nr)
+        nr = lrcu_data->nr;
+    memcpy(lrcu_data->batch, lrcu_data->list, sizeof(void *) * nr);
+    __lrcu_list_drop(lrcu_data, nr);
+    lrcu_data->nr_gp++;
+    lrcu_data->nr_cb += nr;
     spin_unlock(&lrcu_data->list_lock);
 
-    smp_mb();
+    for (i = 0; i < nr; i++)
+        lrcu_data->callback((void __force *)lrcu_data->batch[i]);
+
+    /* The callbacks are done before lrcu_barrier() returns. */
+    smp_store_release(&lrcu_data->nr_done, req);
+
+    TRACE_CALC(lrcu_data->trace);
+    TRACE_PRINT(lrcu_data->trace);
+
+    wake_up_all(&lrcu_data->wait);
+}
+
+static int __lrcu_worker(void *data)
+{
+    struct lrcu_data *lrcu_data = (struct lrcu_data *)data;
+
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(lrcu_data->wait,
+                                 READ_ONCE(lrcu_data->nr_req) !=
+                                         READ_ONCE(lrcu_data->nr_done) ||
+                                     kthread_should_stop());
+        __lrcu_do_batch(lrcu_data);
+    }
+
+    /* The requests before lrcu_data_free() */
+    __lrcu_do_batch(lrcu_data);
 
-    do_exit(0);
+    return 0;
 }
 
+/* Pass the pointers retired so far to the callback after a grace period,
+ * it never blocks. The requests before the worker wakes up share one
+ * grace period.
+ */
 static __inline__ void call_lrcu(struct lrcu_data *lrcu_data)
 {
     smp_mb();
-    kthread_run(__call_lrcu, (void *)lrcu_data, "kthread: call_lrcu");
+
+    spin_lock(&lrcu_data->list_lock);
+    lrcu_data->nr_req++;
+    spin_unlock(&lrcu_data->list_lock);
+
+    wake_up(&lrcu_data->wait);
+}
+
+/* Wait for the requests before have been served. */
+static __inline__ void lrcu_barrier(struct lrcu_data *lrcu_data)
+{
+    unsigned long req = READ_ONCE(lrcu_data->nr_req);
+
+    wait_event(lrcu_data->wait,
+               (long)(smp_load_acquire(&lrcu_data->nr_done) - req) >= 0);
+}
+
+/* Serve the remaining requests and stop the worker. */
+static __inline__ void lrcu_data_free(struct lrcu_data *lrcu_data)
+{
+    kthread_stop(lrcu_data->worker);
+
+    pr_info("lrcu: %lu callbacks, %lu requests in %lu grace periods\n",
+            lrcu_data->nr_cb, lrcu_data->nr_req, lrcu_data->nr_gp);
+
+    kfree(lrcu_data->batch);
+    kfree(lrcu_data->list);
+    kfree(lrcu_data);
 }
 
 #endif /* __LRCU_H__ */
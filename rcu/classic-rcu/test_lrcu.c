@@ -23,7 +23,6 @@
 #include <linux/slab.h>
 #include <linux/kthread.h>
 
-#include "trace_time.h"
 #include "rcu.h"
 
 struct test_lrcu {
@@ -53,8 +52,6 @@ static int read_side(void *data)
     return 0;
 }
 
-struct trace_time trace_update;
-
 static int update_side(void *data)
 {
     struct test *oldp, *newp;
@@ -68,15 +65,13 @@ static int update_side(void *data)
     newp->val = test_info->tid;
 
     oldp = lrcu_assign_pointer(gp, newp, test_info->ld);
-    if (oldp == NULL)
+    if (oldp == NULL) {
+        kfree(newp);
         return -1;
+    }
 
-    TRACE_TIME_START(trace_update);
-    synchronize_lrcu(test_info->ld);
-    TRACE_TIME_END(trace_update);
-    TRACE_CALC(trace_update);
-    TRACE_PRINT(trace_update);
-    kfree(oldp);
+    /* The worker frees oldp by lrcu_call_back() */
+    call_lrcu(test_info->ld);
 
     return 0;
 }
@@ -96,10 +91,7 @@ static int __init lrcu_init(void)
 {
     int i, *setp;
 
-    lrcu_data = lrcu_data_init(lrcu_call_back);
-    if (!lrcu_data)
-        return -1;
-
+    /* The worker of lrcu_data uses the sched_setaffinity() */
     i = lrcu_sched_init();
     if (i != 0)
         return -1;
@@ -114,14 +106,20 @@ static int __init lrcu_init(void)
     gp = (struct test __lrcu *)kmalloc(sizeof(struct test), GFP_KERNEL);
     if (gp == NULL) {
         pr_alert("lrcu_init: gp kmalloc failed\n");
+        kfree(t);
         return -ENOMEM;
     }
 
+    lrcu_data = lrcu_data_init(lrcu_call_back);
+    if (!lrcu_data) {
+        kfree((struct test __force *)gp);
+        kfree(t);
+        return -1;
+    }
+
     setp = (int __force *)&gp->val;
     *setp = -1;
 
-    trace_update = TRACE_TIME_INIT("trace lrcu");
-
     for (i = 0; i < NR_TOTAL; i++) {
         t[i].tid = i;
         t[i].ld = lrcu_data;
@@ -137,17 +135,16 @@ static int __init lrcu_init(void)
     for (i = 0; i < NR_TOTAL; i++)
         wake_up_process(t[i].task);
 
-    call_lrcu(lrcu_data);
-
     return 0;
 }
 
 static void __exit lrcu_exit(void)
 {
     lrcu_assign_pointer(gp, NULL, lrcu_data);
+    call_lrcu(lrcu_data);
 
-    synchronize_lrcu(lrcu_data);
-    kfree(lrcu_data);
+    /* Serve the remaining requests and stop the worker */
+    lrcu_data_free(lrcu_data);
     kfree(t);
 }
 
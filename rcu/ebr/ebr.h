@@ -0,0 +1,333 @@
+/*
+ * Epoch-based reclamation: Non-blocking deferred free with per-thread epochs
+ *
+ * The readers announce the global epoch they have seen when entering the
+ * critical section. The retired objects go to the limbo list of the epoch
+ * they are retired in, each thread has three of them. The global epoch can
+ * only advance when all the active readers have seen it, so once it has
+ * advanced twice the objects cannot be reached by any reader. The updater
+ * tries to advance the epoch when retiring, the readers try it when leaving
+ * the critical section. The updater never waits for the readers unless
+ * the limbo lists are bounded by EBR_LIMBO_MAX.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#ifndef __EBR_H__
+#define __EBR_H__
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../api.h"
+
+#ifdef __CHECKER__
+#define __rcu __attribute__((noderef, address_space(__rcu)))
+#define rcu_check_sparse(p, space) ((void)(((typeof(*p) space *)p) == p))
+#define __force __attribute__((force))
+#define rcu_uncheck(p) ((__typeof__(*p) __force *)p)
+#define rcu_check(p) ((__typeof__(*p) __force __rcu *)p)
+#else
+#define __rcu
+#define rcu_check_sparse(p, space)
+#define __force
+#define rcu_uncheck(p) p
+#define rcu_check(p) p
+#endif /* __CHECKER__ */
+
+/* Avoid false sharing */
+#define __ebr_aligned __attribute__((aligned(128)))
+
+/* Try to advance the global epoch every EBR_ADVANCE_FREQ retires. */
+#ifndef EBR_ADVANCE_FREQ
+#define EBR_ADVANCE_FREQ 64
+#endif
+
+/* Define EBR_LIMBO_MAX to bound the retired but not yet freed objects of
+ * each thread, then ebr_retire() waits for the readers over it. It is off
+ * by default: a retirer holding a lock which a preempted reader needs
+ * would wait forever.
+ */
+
+#define EBR_NR_LIMBO 3
+/* The announced state is the epoch shifted left by one with the LSB set
+ * while the thread is in the critical section.
+ */
+#define EBR_ACTIVE 0x1UL
+
+struct ebr_head {
+    struct ebr_head *next;
+    void (*func)(struct ebr_head *head);
+};
+
+struct ebr_limbo {
+    unsigned long epoch;
+    struct ebr_head *head;
+};
+
+struct ebr_node {
+    unsigned long state;
+    int used;
+    unsigned int nr_retire;
+    unsigned int nr_unlock;
+    unsigned long nr_limbo;
+    struct ebr_limbo limbo[EBR_NR_LIMBO];
+    struct ebr_node *next;
+} __ebr_aligned;
+
+/* The records are never freed until ebr_clean(), so the epoch advancing
+ * walks them without lock. An unregistered record is reused by the next
+ * thread, which takes over its limbo lists.
+ */
+struct ebr_data {
+    unsigned long epoch;
+    struct ebr_node *head;
+};
+
+static struct ebr_data ebr_data = { .epoch = 0, .head = NULL };
+static __thread struct ebr_node *__ebr_per_thrd_ptr;
+static __thread unsigned int __ebr_per_thrd_depth;
+
+static __inline__ int ebr_register_thread(void)
+{
+    struct ebr_node *node;
+    int used;
+
+    if (__ebr_per_thrd_ptr)
+        return 0;
+
+    for (node = __atomic_load_n(&ebr_data.head, __ATOMIC_ACQUIRE); node;
+         node = node->next) {
+        used = 0;
+        if (!READ_ONCE(node->used) &&
+            __atomic_compare_exchange_n(&node->used, &used, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            __ebr_per_thrd_ptr = node;
+            return 0;
+        }
+    }
+
+    node = (struct ebr_node *)aligned_alloc(128, sizeof(struct ebr_node));
+    if (!node)
+        return -ENOMEM;
+    memset(node, 0, sizeof(struct ebr_node));
+    node->used = 1;
+
+    node->next = __atomic_load_n(&ebr_data.head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&ebr_data.head, &node->next, node, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    __ebr_per_thrd_ptr = node;
+
+    return 0;
+}
+
+/* It must be outside the critical section. */
+static __inline__ void ebr_unregister_thread(void)
+{
+    if (!__ebr_per_thrd_ptr)
+        return;
+
+    __atomic_store_n(&__ebr_per_thrd_ptr->used, 0, __ATOMIC_RELEASE);
+    __ebr_per_thrd_ptr = NULL;
+}
+
+static __inline__ void ebr_read_lock(void)
+{
+    unsigned long epoch;
+
+    if (__ebr_per_thrd_depth++) {
+        barrier();
+        return;
+    }
+
+    epoch = __atomic_load_n(&ebr_data.epoch, __ATOMIC_RELAXED);
+    WRITE_ONCE(__ebr_per_thrd_ptr->state, epoch << 1 | EBR_ACTIVE);
+    smp_mb();
+}
+
+/* Advance the global epoch if all the active readers have seen it, return
+ * 0 without waiting otherwise.
+ */
+static __inline__ int ebr_try_advance(void)
+{
+    unsigned long epoch, state;
+    struct ebr_node *node;
+
+    smp_mb();
+    epoch = __atomic_load_n(&ebr_data.epoch, __ATOMIC_ACQUIRE);
+
+    for (node = __atomic_load_n(&ebr_data.head, __ATOMIC_ACQUIRE); node;
+         node = node->next) {
+        state = READ_ONCE(node->state);
+        if ((state & EBR_ACTIVE) && (state >> 1) != epoch)
+            return 0;
+    }
+
+    return __atomic_compare_exchange_n(&ebr_data.epoch, &epoch, epoch + 1, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static __inline__ void __ebr_limbo_free(struct ebr_node *node,
+                                        struct ebr_limbo *limbo)
+{
+    struct ebr_head *head, *next;
+
+    for (head = limbo->head; head; head = next) {
+        next = head->next;
+        head->func(head);
+        node->nr_limbo--;
+    }
+    limbo->head = NULL;
+}
+
+/* The objects retired in epoch e are unreachable once the epoch is e + 2. */
+static __inline__ void __ebr_reclaim(struct ebr_node *node, unsigned long epoch)
+{
+    int i;
+
+    for (i = 0; i < EBR_NR_LIMBO; i++) {
+        if (node->limbo[i].head && node->limbo[i].epoch + 2 <= epoch)
+            __ebr_limbo_free(node, &node->limbo[i]);
+    }
+}
+
+/* Try to advance the epoch and free the limbo lists of this thread which
+ * have become unreachable. It must be outside the critical section.
+ */
+static __inline__ void ebr_quiescent(void)
+{
+    struct ebr_node *node = __ebr_per_thrd_ptr;
+
+    if (!node)
+        return;
+
+    ebr_try_advance();
+    __ebr_reclaim(node, __atomic_load_n(&ebr_data.epoch, __ATOMIC_ACQUIRE));
+}
+
+static __inline__ void ebr_read_unlock(void)
+{
+    struct ebr_node *node = __ebr_per_thrd_ptr;
+
+    barrier();
+    if (--__ebr_per_thrd_depth)
+        return;
+    __atomic_store_n(&node->state, 0, __ATOMIC_RELEASE);
+
+    /* Help the updaters, which may be preempted, to advance the epoch. */
+    if (++node->nr_unlock % EBR_ADVANCE_FREQ == 0)
+        ebr_quiescent();
+}
+
+/* The object must have been unlinked, the callback frees it later. */
+static __inline__ void ebr_retire(struct ebr_head *head,
+                                  void (*func)(struct ebr_head *head))
+{
+    struct ebr_node *node;
+    struct ebr_limbo *limbo;
+    unsigned long epoch;
+
+    if (!__ebr_per_thrd_ptr && ebr_register_thread()) {
+        fprintf(stderr, "ebr_retire: ebr_register_thread failed\n");
+        abort();
+    }
+    node = __ebr_per_thrd_ptr;
+
+    if (++node->nr_retire % EBR_ADVANCE_FREQ == 0)
+        ebr_try_advance();
+
+    /* The unlink must be before reading the epoch. */
+    smp_mb();
+    epoch = __atomic_load_n(&ebr_data.epoch, __ATOMIC_ACQUIRE);
+    __ebr_reclaim(node, epoch);
+
+#ifdef EBR_LIMBO_MAX
+    /* Bound the limbo lists by waiting for the readers. The thread holding
+     * the read lock cannot wait since the epoch is stuck on itself.
+     */
+    while (node->nr_limbo >= EBR_LIMBO_MAX && !__ebr_per_thrd_depth) {
+        if (!ebr_try_advance())
+            usleep(10);
+        smp_mb();
+        epoch = __atomic_load_n(&ebr_data.epoch, __ATOMIC_ACQUIRE);
+        __ebr_reclaim(node, epoch);
+    }
+#endif
+
+    /* The list of epoch % 3 is either empty or of the same epoch here. */
+    head->func = func;
+    limbo = &node->limbo[epoch % EBR_NR_LIMBO];
+    limbo->epoch = epoch;
+    head->next = limbo->head;
+    limbo->head = head;
+    node->nr_limbo++;
+}
+
+/* Wait until the objects retired by this thread have been freed, it spins
+ * on the readers so it is only for the teardown.
+ */
+static __inline__ void ebr_barrier(void)
+{
+    unsigned long target;
+
+    if (!__ebr_per_thrd_ptr)
+        return;
+
+    target = __atomic_load_n(&ebr_data.epoch, __ATOMIC_ACQUIRE) + 2;
+    while ((long)(__atomic_load_n(&ebr_data.epoch, __ATOMIC_ACQUIRE) -
+                  target) < 0) {
+        if (!ebr_try_advance())
+            usleep(10);
+    }
+    __ebr_reclaim(__ebr_per_thrd_ptr, target);
+}
+
+/* Free all the limbo lists and records, the readers should have finished. */
+static __inline__ void ebr_clean(void)
+{
+    struct ebr_node *node, *tmp;
+    int i;
+
+    for (node = ebr_data.head; node != NULL; node = tmp) {
+        tmp = node->next;
+        for (i = 0; i < EBR_NR_LIMBO; i++)
+            __ebr_limbo_free(node, &node->limbo[i]);
+        free(node);
+    }
+    ebr_data.head = NULL;
+    __ebr_per_thrd_ptr = NULL;
+}
+
+#define rcu_dereference(p)                                                \
+    ({                                                                    \
+        __typeof__(*p) *__r_d_p = (__typeof__(*p) __force *)READ_ONCE(p); \
+        rcu_check_sparse(p, __rcu);                                       \
+        __r_d_p;                                                          \
+    })
+
+#define rcu_assign_pointer(p, v)                                              \
+    ({                                                                        \
+        __typeof__(*p) *__r_a_p =                                             \
+            (__typeof__(*p) __force *)__atomic_exchange_n(                    \
+                &(p), (__typeof__(*(p)) __force __rcu *)v, __ATOMIC_RELEASE); \
+        rcu_check_sparse(p, __rcu);                                           \
+        __r_a_p;                                                              \
+    })
+
+#endif /* __EBR_H__ */
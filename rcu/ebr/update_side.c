@@ -0,0 +1,155 @@
+/*
+ * Update side benchmark: A benchmark of epoch-based reclamation
+ *
+ * The readers keep reading while the updaters replace and retire the data
+ * as fast as they can. The updaters never wait for the readers, so the
+ * cost is the number of the retired but not yet freed data.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ebr.h"
+#include "../trace_timer.h"
+
+/* The trace time measures TRACE_LOOP updates of each updater. */
+#ifdef CONFIG_TRACE_TIME
+#define NR_UPDATE TRACE_LOOP
+#else
+#define NR_UPDATE UPDATE_NUM
+#endif
+
+struct test {
+    int count;
+    struct ebr_head ebr;
+};
+
+static struct test __rcu *foo;
+static int stop;
+static long nr_pending;
+static long peak_pending;
+
+static void *reader_side(void *argv)
+{
+    struct test __allow_unused *tmp;
+
+    ebr_register_thread();
+
+    while (!READ_ONCE(stop)) {
+        ebr_read_lock();
+
+        tmp = rcu_dereference(foo);
+
+        ebr_read_unlock();
+    }
+
+    ebr_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+static void free_ebr(struct ebr_head *head)
+{
+    __atomic_fetch_sub(&nr_pending, 1, __ATOMIC_RELAXED);
+    free((char *)head - offsetof(struct test, ebr));
+}
+
+static __inline__ void update_ebr(void)
+{
+    struct test *newval = (struct test *)malloc(sizeof(struct test));
+    newval->count = current_tid();
+
+    struct test *oldp;
+    long pending;
+
+    oldp = rcu_assign_pointer(foo, newval);
+
+    pending = __atomic_add_fetch(&nr_pending, 1, __ATOMIC_RELAXED);
+    if (pending > READ_ONCE(peak_pending))
+        WRITE_ONCE(peak_pending, pending);
+
+    ebr_retire(&oldp->ebr, free_ebr);
+}
+
+static void *updater_side(void *argv)
+{
+#ifdef CONFIG_TRACE_TIME
+    time_check_loop(update_ebr(), TRACE_LOOP);
+#else
+    int i;
+
+    for (i = 0; i < UPDATE_NUM; i++)
+        update_ebr();
+#endif
+
+    ebr_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+static __inline__ void benchmark(void)
+{
+    pthread_t reader[READER_NUM];
+    pthread_t updater[UPDATER_NUM];
+    struct timespec start, end;
+    double during;
+    int i;
+    foo = (struct test __rcu *)malloc(sizeof(struct test));
+    rcu_uncheck(foo)->count = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < READER_NUM / 2; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+
+    for (i = 0; i < UPDATER_NUM; i++)
+        pthread_create(&updater[i], NULL, updater_side, NULL);
+
+    for (i = READER_NUM / 2; i < READER_NUM; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+
+    for (i = 0; i < UPDATER_NUM; i++)
+        pthread_join(updater[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    WRITE_ONCE(stop, 1);
+    for (i = 0; i < READER_NUM; i++)
+        pthread_join(reader[i], NULL);
+
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%.0f updates/sec, peak %ld unreclaimed\n",
+           (double)UPDATER_NUM * NR_UPDATE / during, peak_pending);
+
+    free(rcu_uncheck(foo));
+
+    ebr_clean();
+}
+
+int main(int argc, char *argv[])
+{
+    printf("ebr update side: reader %d, updater %d\n", READER_NUM,
+           UPDATER_NUM);
+    benchmark();
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Domain benchmark: Many protected pointers of global reference count RCU
+ *
+ * A table of PTR_NUM config entries, each reader critical section reads
+ * PTR_PER_READ random entries. Compare one rcu_head per entry with one
+ * domain for the whole table.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rcupdate.h"
+
+#ifndef PTR_NUM
+#define PTR_NUM 10000
+#endif
+
+#ifndef PTR_PER_READ
+#define PTR_PER_READ 16
+#endif
+
+struct test {
+    int count;
+};
+
+static int stop;
+
+#ifdef CONFIG_DOMAIN
+
+RCU_DOMAIN_DEFINE(domain);
+static struct test __rcu *table[PTR_NUM];
+
+#define TLS_SIZE sizeof(struct rcu_node *)
+#define HEAD_SIZE (sizeof(struct rcu_head) + sizeof(struct rcu_node))
+
+static __inline__ long read_table(unsigned int *seed)
+{
+    struct test *tmp;
+    long sum = 0;
+    int i;
+
+    rcu_domain_read_lock(domain);
+    for (i = 0; i < PTR_PER_READ; i++) {
+        tmp = rcu_domain_dereference(table[rand_r(seed) % PTR_NUM]);
+        sum += tmp->count;
+    }
+    rcu_domain_read_unlock(domain);
+
+    return sum;
+}
+
+static __inline__ void update_table(unsigned int *seed)
+{
+    struct test *newval = (struct test *)malloc(sizeof(struct test));
+    struct test *oldp;
+
+    newval->count = 1;
+    oldp = rcu_domain_assign_pointer(table[rand_r(seed) % PTR_NUM], newval);
+
+    rcu_domain_synchronize(&domain);
+    free(oldp);
+}
+
+static void table_init(void)
+{
+    struct test *obj;
+    int i;
+
+    rcu_domain_init(&domain);
+    for (i = 0; i < PTR_NUM; i++) {
+        obj = (struct test *)malloc(sizeof(struct test));
+        obj->count = 1;
+        table[i] = obj;
+    }
+}
+
+static void table_exit(void)
+{
+    int i;
+
+    for (i = 0; i < PTR_NUM; i++)
+        free(table[i]);
+    rcu_free(&domain);
+}
+
+#else /* !CONFIG_DOMAIN */
+
+/* RCU_DEFINE() can not make an array, so do what it does per entry. */
+static struct rcu_head table[PTR_NUM];
+static __thread struct rcu_node *table_per_thread[PTR_NUM];
+
+#define TLS_SIZE sizeof(table_per_thread)
+#define HEAD_SIZE (PTR_NUM * (sizeof(struct rcu_head) + sizeof(struct rcu_node)))
+
+static __inline__ long read_table(unsigned int *seed)
+{
+    struct test *tmp;
+    long sum = 0;
+    int i, idx;
+
+    for (i = 0; i < PTR_PER_READ; i++) {
+        idx = rand_r(seed) % PTR_NUM;
+        __rcu_read_access(&table[idx], &table_per_thread[idx],
+                          __RCU_READ_LOCK);
+        tmp = __rcu_read_access(&table[idx], &table_per_thread[idx],
+                                __RCU_READ_DEREFERENCE);
+        sum += tmp->count;
+        __rcu_read_access(&table[idx], &table_per_thread[idx],
+                          __RCU_READ_UNLOCK);
+    }
+
+    return sum;
+}
+
+static __inline__ void update_table(unsigned int *seed)
+{
+    struct test *newval = (struct test *)malloc(sizeof(struct test));
+    int idx = rand_r(seed) % PTR_NUM;
+
+    newval->count = 1;
+    rcu_assign_pointer(&table[idx], (void *)newval);
+
+    synchronize_rcu(&table[idx]);
+}
+
+static void table_init(void)
+{
+    struct test *obj;
+    int i;
+
+    for (i = 0; i < PTR_NUM; i++) {
+        obj = (struct test *)malloc(sizeof(struct test));
+        obj->count = 1;
+        rcu_init(obj, &table[i]);
+    }
+}
+
+static void table_exit(void)
+{
+    int i;
+
+    for (i = 0; i < PTR_NUM; i++)
+        rcu_free(&table[i]);
+}
+
+#endif /* CONFIG_DOMAIN */
+
+static unsigned long nr_read;
+
+static void *reader_side(void *argv)
+{
+    unsigned int seed = (unsigned int)(unsigned long)argv;
+    unsigned long count = 0;
+
+    while (!READ_ONCE(stop)) {
+        if (read_table(&seed) != PTR_PER_READ)
+            abort();
+        count++;
+    }
+    __atomic_fetch_add(&nr_read, count, __ATOMIC_RELAXED);
+
+    pthread_exit(NULL);
+}
+
+static void *updater_side(void *argv)
+{
+    unsigned int seed = (unsigned int)(unsigned long)argv;
+    int i;
+
+    for (i = 0; i < UPDATE_NUM; i++)
+        update_table(&seed);
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t reader[READER_NUM];
+    pthread_t updater[UPDATER_NUM];
+    struct timespec start, end;
+    double during;
+    long i;
+
+    table_init();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < READER_NUM; i++)
+        pthread_create(&reader[i], NULL, reader_side, (void *)i);
+    for (i = 0; i < UPDATER_NUM; i++)
+        pthread_create(&updater[i], NULL, updater_side,
+                       (void *)(READER_NUM + i));
+
+    for (i = 0; i < UPDATER_NUM; i++)
+        pthread_join(updater[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    WRITE_ONCE(stop, 1);
+    for (i = 0; i < READER_NUM; i++)
+        pthread_join(reader[i], NULL);
+
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+#ifdef CONFIG_DOMAIN
+    printf("locked rcu domain: ");
+#else
+    printf("locked rcu head per pointer: ");
+#endif
+    printf("reader %d, updater %d, pointer %d, %d per read\n", READER_NUM,
+           UPDATER_NUM, PTR_NUM, PTR_PER_READ);
+    printf("%.0f pointers read/sec, %.0f updates/sec\n",
+           (double)nr_read * PTR_PER_READ / during,
+           (double)UPDATER_NUM * UPDATE_NUM / during);
+    printf("memory: head %zu bytes, tls %zu bytes per thread\n",
+           (size_t)HEAD_SIZE, (size_t)TLS_SIZE);
+
+    table_exit();
+
+    return 0;
+}
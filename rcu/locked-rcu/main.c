@@ -20,6 +20,7 @@
  * Copyright (C) 2021 linD026
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
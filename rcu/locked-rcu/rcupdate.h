@@ -41,16 +41,96 @@
 
 #include <stdatomic.h>
 
+/* With CONFIG_PERCPU, the reference count is split into the per-CPU padded
+ * shards. The reader only touches the shard of the CPU it runs on, and the
+ * unlock may land on another shard after migrating, so only the sum of the
+ * shards means anything. The node no longer gets new readers once it has
+ * been replaced, the late reader backs off on the same shard, so the sum
+ * read by synchronize_rcu() is never smaller than the real one.
+ */
+#ifdef CONFIG_PERCPU
+#include <sched.h>
+
+#ifndef RCU_NR_CPU
+#define RCU_NR_CPU 64
+#endif
+
+struct rcu_percpu {
+    long count;
+} __attribute__((aligned(128)));
+
+static __thread int __rcu_per_thread_cpu;
+#endif
+
 struct rcu_node {
     void *obj;
+#ifdef CONFIG_PERCPU
+    struct rcu_percpu percpu[RCU_NR_CPU];
+#else
     unsigned int count;
+#endif
     struct rcu_node *next;
 };
 
+static __inline__ struct rcu_node *__rcu_node_alloc(void)
+{
+    struct rcu_node *node;
+
+#ifdef CONFIG_PERCPU
+    int i;
+
+    node = (struct rcu_node *)aligned_alloc(128, sizeof(struct rcu_node));
+    if (!node) {
+        fprintf(stderr, "__rcu_node_alloc:allocate failed\n");
+        abort();
+    }
+    for (i = 0; i < RCU_NR_CPU; i++)
+        node->percpu[i].count = 0;
+#else
+    node = (struct rcu_node *)malloc(sizeof(struct rcu_node));
+    if (!node) {
+        fprintf(stderr, "__rcu_node_alloc:allocate failed\n");
+        abort();
+    }
+    node->count = 0;
+#endif
+    node->next = NULL;
+
+    return node;
+}
+
+#ifdef CONFIG_PERCPU
+#define __rcu_count_lock(node)                                          \
+    (&(node)->percpu[__rcu_per_thread_cpu = sched_getcpu() % RCU_NR_CPU] \
+          .count)
+#define __rcu_count_unlock(node) (&(node)->percpu[__rcu_per_thread_cpu].count)
+
+static __inline__ long __rcu_count_sum(struct rcu_node *node)
+{
+    long sum = 0;
+    int i;
+
+    for (i = 0; i < RCU_NR_CPU; i++)
+        sum += READ_ONCE(node->percpu[i].count);
+
+    return sum;
+}
+#else
+#define __rcu_count_lock(node) (&(node)->count)
+#define __rcu_count_unlock(node) (&(node)->count)
+#define __rcu_count_sum(node) READ_ONCE((node)->count)
+#endif
+
+/* The reclaimed nodes are kept in the pool and reused by the later
+ * rcu_assign_pointer(), so the updates stop allocating after warming up.
+ * The count of the pooled node is left as it is, since the late reader
+ * can still back off on it.
+ */
 struct rcu_head {
     size_t objsize;
     struct rcu_node *node;
     struct rcu_node *current;
+    struct rcu_node *pool;
     spinlock_t sp;
 } __attribute__((aligned(sizeof(void *))));
 
@@ -63,19 +143,36 @@ struct rcu_head {
 static __inline__ void __rcu_init(void *obj, struct rcu_head *head,
                                   size_t objsize)
 {
-    head->current = (struct rcu_node *)malloc(sizeof(struct rcu_node));
-    if (!head->current) {
-        fprintf(stderr, "__rcu_init:allocate failed\n");
-        abort();
-    }
+    head->current = __rcu_node_alloc();
     head->current->obj = obj;
-    head->current->count = 0;
-    head->current->next = NULL;
     head->objsize = objsize;
     head->node = NULL;
+    head->pool = NULL;
     spin_lock_init(&head->sp);
 }
 
+/* Both need head->sp */
+static __inline__ struct rcu_node *__rcu_node_get(struct rcu_head *head)
+{
+    struct rcu_node *node = head->pool;
+
+    if (!node)
+        return __rcu_node_alloc();
+
+    head->pool = node->next;
+    node->next = NULL;
+
+    return node;
+}
+
+static __inline__ void __rcu_node_put(struct rcu_head *head,
+                                      struct rcu_node *node)
+{
+    node->obj = NULL;
+    node->next = head->pool;
+    head->pool = node;
+}
+
 #define __RCU_READ_LOCK 0x0
 #define __RCU_READ_UNLOCK 0x1
 #define __RCU_READ_DEREFERENCE 0x2
@@ -85,11 +182,22 @@ static __inline__ void *__rcu_read_access(struct rcu_head *head,
 {
     switch (ops) {
     case __RCU_READ_LOCK:
-        *current = READ_ONCE(head->current);
-        atomic_fetch_add_explicit(&(*current)->count, 1, memory_order_seq_cst);
+        /* The node may have been replaced and reclaimed before the count
+         * is taken, back off and take the new one.
+         */
+        for (;;) {
+            *current = __atomic_load_n(&head->current, __ATOMIC_ACQUIRE);
+            atomic_fetch_add_explicit(__rcu_count_lock(*current), 1,
+                                      memory_order_seq_cst);
+            if (READ_ONCE(head->current) == *current)
+                break;
+            atomic_fetch_sub_explicit(__rcu_count_unlock(*current), 1,
+                                      memory_order_seq_cst);
+        }
         break;
     case __RCU_READ_UNLOCK:
-        atomic_fetch_sub_explicit(&(*current)->count, 1, memory_order_seq_cst);
+        atomic_fetch_sub_explicit(__rcu_count_unlock(*current), 1,
+                                  memory_order_seq_cst);
         break;
     case __RCU_READ_DEREFERENCE:
         return READ_ONCE((*current)->obj);
@@ -115,18 +223,42 @@ static __inline__ void *__rcu_read_access(struct rcu_head *head,
                           __RCU_READ_DEREFERENCE);                 \
     })
 
-static __inline__ void rcu_assign_pointer(struct rcu_head *head, void *newval)
+/* Free the retired nodes which have no reader, it never waits. */
+static __inline__ void __rcu_reclaim(struct rcu_head *head)
 {
-    struct rcu_node **current = &head->node;
-    struct rcu_node *node = (struct rcu_node *)malloc(sizeof(struct rcu_node));
-    if (!node) {
-        fprintf(stderr, "rcu_assign_pointer:allocate failed\n");
-        abort();
+    struct rcu_node **indirect = &head->node;
+    struct rcu_node *node;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while ((node = *indirect)) {
+        if (__rcu_count_sum(node) != 0) {
+            indirect = &node->next;
+            continue;
+        }
+        atomic_thread_fence(memory_order_acquire);
+        *indirect = node->next;
+        free(node->obj);
+        __rcu_node_put(head, node);
     }
+}
 
-    node->obj = newval;
-    node->count = 0;
-    node->next = NULL;
+static __inline__ void rcu_reclaim(struct rcu_head *head)
+{
+    spin_lock(&head->sp);
+    __rcu_reclaim(head);
+    spin_unlock(&head->sp);
+}
+
+/* With CONFIG_DEFER, the update reclaims the retired nodes which have no
+ * reader left instead of waiting in synchronize_rcu(). The others stay in
+ * the list until the later update or rcu_reclaim(), e.g. from a helper
+ * thread.
+ */
+static __inline__ void rcu_assign_pointer(struct rcu_head *head, void *newval)
+{
+    struct rcu_node **current = &head->node;
+    struct rcu_node *node;
 
     /* Only one updater can write in */
     spin_lock(&head->sp);
@@ -135,18 +267,24 @@ static __inline__ void rcu_assign_pointer(struct rcu_head *head, void *newval)
         /* we don't want to remove the same object as newval */
         if ((*current)->obj == newval) {
             spin_unlock(&head->sp);
-            free(node);
             return;
         }
         current = &(*current)->next;
     }
 
-    WRITE_ONCE(*current, head->current);
-    WRITE_ONCE(head->current, node);
+    node = __rcu_node_get(head);
+    node->obj = newval;
 
     /* C11 memory model */
     atomic_thread_fence(memory_order_release);
 
+    WRITE_ONCE(*current, head->current);
+    WRITE_ONCE(head->current, node);
+
+#ifdef CONFIG_DEFER
+    __rcu_reclaim(head);
+#endif
+
     spin_unlock(&head->sp);
 }
 
@@ -161,13 +299,13 @@ static __inline__ void synchronize_rcu(struct rcu_head *head)
     want_free = head->node;
 
     while (want_free) {
-        while (READ_ONCE(want_free->count) != 0)
+        while (__rcu_count_sum(want_free) != 0)
             barrier();
 
         struct rcu_node *tmp = want_free;
         want_free = want_free->next;
         free(tmp->obj);
-        free(tmp);
+        __rcu_node_put(head, tmp);
     }
 
     head->node = NULL;
@@ -177,8 +315,65 @@ static __inline__ void synchronize_rcu(struct rcu_head *head)
     spin_unlock(&head->sp);
 }
 
+/* Domain: many pointers share one rcu_head. The reader takes one count
+ * for the whole domain and reads the pointers directly, the node of the
+ * domain is the generation and carries no object. The updater replaces
+ * the pointers, starts the new generation and waits for the old ones.
+ */
+#define RCU_DOMAIN_DEFINE(domain) RCU_DEFINE(domain)
+
+#define rcu_domain_init(domain) __rcu_init(NULL, (domain), 0)
+
+#define rcu_domain_read_lock(domain) rcu_read_lock(domain)
+#define rcu_domain_read_unlock(domain) rcu_read_unlock(domain)
+
+#define rcu_domain_dereference(p)                    \
+    ({                                               \
+        __typeof__(p) __r_d_p = READ_ONCE(p);        \
+        rcu_check_sparse(p, __rcu);                  \
+        __r_d_p;                                     \
+    })
+
+/* Return the old pointer, free it after rcu_domain_synchronize(). */
+#define rcu_domain_assign_pointer(p, v) \
+    __atomic_exchange_n(&(p), (v), __ATOMIC_RELEASE)
+
+static __inline__ void rcu_domain_synchronize(struct rcu_head *domain)
+{
+    struct rcu_node *node;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    spin_lock(&domain->sp);
+
+    node = __rcu_node_get(domain);
+    node->obj = NULL;
+    domain->current->next = domain->node;
+    domain->node = domain->current;
+    __atomic_store_n(&domain->current, node, __ATOMIC_RELEASE);
+
+    spin_unlock(&domain->sp);
+
+    synchronize_rcu(domain);
+}
+
+/* The readers should have finished. */
 static __inline__ void rcu_free(struct rcu_head *head)
 {
+    struct rcu_node *node, *tmp;
+
+    for (node = head->node; node; node = tmp) {
+        tmp = node->next;
+        free(node->obj);
+        free(node);
+    }
+    for (node = head->pool; node; node = tmp) {
+        tmp = node->next;
+        free(node);
+    }
+    head->node = NULL;
+    head->pool = NULL;
+
     free(head->current->obj);
     free(head->current);
 }
@@ -0,0 +1,10 @@
+#!/usr/bin/env bash
+
+# Read side scaling of the global and the per-CPU reference count
+for COUNT in n y; do
+    for READER in 1 2 4 8 16 32 64; do
+        make -s -C $(dirname $0) read READER_NUM=$READER CONFIG_PERCPU=$COUNT
+        $(dirname $0)/test
+    done
+    echo "-------------------------"
+done
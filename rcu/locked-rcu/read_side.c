@@ -24,11 +24,19 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <pthread.h>
 
 #include "rcupdate.h"
 #include "../trace_timer.h"
 
+/* The trace time measures TRACE_LOOP reads of each reader. */
+#ifdef CONFIG_TRACE_TIME
+#define NR_READ TRACE_LOOP
+#else
+#define NR_READ READ_NUM
+#endif
+
 struct test {
     int count;
 };
@@ -48,7 +56,14 @@ static __inline__ void read_rcu(void)
 
 void *reader_side(void *argv)
 {
+#ifdef CONFIG_TRACE_TIME
     time_check_loop(read_rcu(), TRACE_LOOP);
+#else
+    int i;
+
+    for (i = 0; i < READ_NUM; i++)
+        read_rcu();
+#endif
 
     pthread_exit(NULL);
 }
@@ -71,12 +86,16 @@ static __inline__ void benchmark(void)
 {
     pthread_t reader[READER_NUM];
     pthread_t updater[UPDATER_NUM];
+    struct timespec start, end;
+    double during;
     int i;
     struct test *obj = (struct test *)malloc(sizeof(struct test));
     obj->count = 0;
 
     rcu_init(obj, &rcu_head);
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     for (i = 0; i < READER_NUM / 2; i++)
         pthread_create(&reader[i], NULL, reader_side, NULL);
 
@@ -92,6 +111,10 @@ static __inline__ void benchmark(void)
     for (i = 0; i < UPDATER_NUM; i++)
         pthread_join(updater[i], NULL);
 
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%.0f reads/sec\n", (double)READER_NUM * NR_READ / during);
+
     rcu_free(&rcu_head);
 }
 
@@ -99,7 +122,14 @@ static __inline__ void benchmark(void)
 
 int main(int argc, char *argv[])
 {
-    printf("locked rcu read side: reader %d, updater %d\n", READER_NUM, UPDATER_NUM);
+    const char *count = "global";
+
+#ifdef CONFIG_PERCPU
+    count = "percpu";
+#endif
+
+    printf("locked rcu read side: reader %d, updater %d, %s count\n",
+           READER_NUM, UPDATER_NUM, count);
     benchmark();
     return 0;
 }
@@ -24,26 +24,38 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <pthread.h>
 
 #include "rcupdate.h"
 #include "../trace_timer.h"
 
+/* The trace time measures TRACE_LOOP updates of each updater. */
+#ifdef CONFIG_TRACE_TIME
+#define NR_UPDATE TRACE_LOOP
+#else
+#define NR_UPDATE UPDATE_NUM
+#endif
+
 struct test {
     int count;
 };
 
 RCU_DEFINE(rcu_head);
+static int stop;
 
+/* Keep reading until the updaters finish. */
 void *reader_side(void *argv)
 {
     struct test __allow_unused *tmp;
 
-    rcu_read_lock(rcu_head);
+    while (!READ_ONCE(stop)) {
+        rcu_read_lock(rcu_head);
 
-    tmp = rcu_dereference(rcu_head);
+        tmp = rcu_dereference(rcu_head);
 
-    rcu_read_unlock(rcu_head);
+        rcu_read_unlock(rcu_head);
+    }
 
     pthread_exit(NULL);
 }
@@ -55,12 +67,21 @@ static __inline__ void update_rcu(void)
 
     rcu_assign_pointer(&rcu_head, (void *)newval);
 
+#ifndef CONFIG_DEFER
     synchronize_rcu(&rcu_head);
+#endif
 }
 
 void *updater_side(void *argv)
 {
+#ifdef CONFIG_TRACE_TIME
     time_check_loop(update_rcu(), TRACE_LOOP);
+#else
+    int i;
+
+    for (i = 0; i < UPDATE_NUM; i++)
+        update_rcu();
+#endif
 
     pthread_exit(NULL);
 }
@@ -69,12 +90,16 @@ static __inline__ void benchmark(void)
 {
     pthread_t reader[READER_NUM];
     pthread_t updater[UPDATER_NUM];
+    struct timespec start, end;
+    double during;
     int i;
     struct test *obj = (struct test *)malloc(sizeof(struct test));
     obj->count = 0;
 
     rcu_init(obj, &rcu_head);
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     for (i = 0; i < READER_NUM / 2; i++)
         pthread_create(&reader[i], NULL, reader_side, NULL);
 
@@ -84,11 +109,17 @@ static __inline__ void benchmark(void)
     for (i = READER_NUM / 2; i < READER_NUM; i++)
         pthread_create(&reader[i], NULL, reader_side, NULL);
 
+    for (i = 0; i < UPDATER_NUM; i++)
+        pthread_join(updater[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    WRITE_ONCE(stop, 1);
     for (i = 0; i < READER_NUM; i++)
         pthread_join(reader[i], NULL);
 
-    for (i = 0; i < UPDATER_NUM; i++)
-        pthread_join(updater[i], NULL);
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%.0f updates/sec\n", (double)UPDATER_NUM * NR_UPDATE / during);
 
     rcu_free(&rcu_head);
 }
@@ -97,7 +128,14 @@ static __inline__ void benchmark(void)
 
 int main(int argc, char *argv[])
 {
-    printf("locked rcu update side: reader %d, updater %d\n", READER_NUM, UPDATER_NUM);
+    const char *mode = "synchronize_rcu";
+
+#ifdef CONFIG_DEFER
+    mode = "deferred free";
+#endif
+
+    printf("locked rcu update side: reader %d, updater %d, %s\n", READER_NUM,
+           UPDATER_NUM, mode);
     benchmark();
     return 0;
 }
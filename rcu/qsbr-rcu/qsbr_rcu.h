@@ -0,0 +1,216 @@
+/*
+ * Quiescent-state-based RCU: Zero-cost readers in userspace
+ *
+ * The read-side critical section compiles to nothing. Instead, every
+ * registered thread announces the quiescent state by rcu_quiescent_state()
+ * at the point which holds no RCU protected pointer, e.g. the boundary of
+ * its main loop. The grace period ends when all the online threads have
+ * announced the quiescent state after it started. A thread which blocks
+ * for a long time should go offline, so the grace period does not wait
+ * for it.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#ifndef __QSBR_RCU_H__
+#define __QSBR_RCU_H__
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "../api.h"
+
+#ifdef __CHECKER__
+#define __rcu __attribute__((noderef, address_space(__rcu)))
+#define rcu_check_sparse(p, space) ((void)(((typeof(*p) space *)p) == p))
+#define __force __attribute__((force))
+#define rcu_uncheck(p) ((__typeof__(*p) __force *)p)
+#define rcu_check(p) ((__typeof__(*p) __force __rcu *)p)
+#else
+#define __rcu
+#define rcu_check_sparse(p, space)
+#define __force
+#define rcu_uncheck(p) p
+#define rcu_check(p) p
+#endif /* __CHECKER__ */
+
+/* Avoid false sharing */
+#define __rcu_aligned __attribute__((aligned(128)))
+
+/* The grace-period counter never be zero, zero means offline. */
+#define RCU_GP_ONLINE 0x1UL
+#define RCU_GP_CTR 0x2UL
+
+struct rcu_node {
+    unsigned long ctr;
+    struct rcu_node *next;
+} __rcu_aligned;
+
+struct rcu_data {
+    unsigned long gp_ctr;
+    struct rcu_node *head;
+    spinlock_t sp;
+};
+
+static struct rcu_data rcu_data = { .gp_ctr = RCU_GP_ONLINE,
+                                    .head = NULL,
+                                    .sp = SPINLOCK_INIT };
+static __thread struct rcu_node *__rcu_per_thrd_ptr;
+
+static __inline__ int rcu_register_thread(void)
+{
+    struct rcu_node *node;
+
+    if (__rcu_per_thrd_ptr)
+        return 0;
+
+    node = (struct rcu_node *)aligned_alloc(128, sizeof(struct rcu_node));
+    if (!node)
+        return -ENOMEM;
+
+    spin_lock(&rcu_data.sp);
+    node->ctr = READ_ONCE(rcu_data.gp_ctr);
+    node->next = rcu_data.head;
+    rcu_data.head = node;
+    spin_unlock(&rcu_data.sp);
+
+    __rcu_per_thrd_ptr = node;
+    smp_mb();
+
+    return 0;
+}
+
+static __inline__ int rcu_init(void)
+{
+    return rcu_register_thread();
+}
+
+/* The per-thread counter will only modified by their owner thread but will
+ * read by the updater. The fences order the announcement with the reads
+ * before and after it.
+ */
+static __inline__ void rcu_quiescent_state(void)
+{
+    smp_mb();
+    WRITE_ONCE(__rcu_per_thrd_ptr->ctr, READ_ONCE(rcu_data.gp_ctr));
+    smp_mb();
+}
+
+static __inline__ void rcu_thread_offline(void)
+{
+    smp_mb();
+    WRITE_ONCE(__rcu_per_thrd_ptr->ctr, 0);
+}
+
+static __inline__ void rcu_thread_online(void)
+{
+    WRITE_ONCE(__rcu_per_thrd_ptr->ctr, READ_ONCE(rcu_data.gp_ctr));
+    smp_mb();
+}
+
+static __inline__ void rcu_unregister_thread(void)
+{
+    struct rcu_node **indirect = &rcu_data.head;
+
+    if (!__rcu_per_thrd_ptr)
+        return;
+
+    rcu_thread_offline();
+
+    spin_lock(&rcu_data.sp);
+    while (*indirect != __rcu_per_thrd_ptr)
+        indirect = &(*indirect)->next;
+    *indirect = __rcu_per_thrd_ptr->next;
+    spin_unlock(&rcu_data.sp);
+
+    free(__rcu_per_thrd_ptr);
+    __rcu_per_thrd_ptr = NULL;
+}
+
+static __inline__ void rcu_clean(void)
+{
+    struct rcu_node *node, *tmp;
+
+    spin_lock(&rcu_data.sp);
+
+    for (node = rcu_data.head; node != NULL; node = tmp) {
+        tmp = node->next;
+        free(node);
+    }
+    rcu_data.head = NULL;
+
+    spin_unlock(&rcu_data.sp);
+}
+
+static __inline__ void rcu_read_lock(void)
+{
+}
+
+static __inline__ void rcu_read_unlock(void)
+{
+}
+
+static __inline__ void synchronize_rcu(void)
+{
+    struct rcu_node *node;
+    unsigned long gp_ctr, ctr;
+    int online = __rcu_per_thrd_ptr && READ_ONCE(__rcu_per_thrd_ptr->ctr);
+
+    /* The updater itself would never announce the quiescent state. */
+    if (online)
+        rcu_thread_offline();
+
+    smp_mb();
+
+    spin_lock(&rcu_data.sp);
+
+    gp_ctr = READ_ONCE(rcu_data.gp_ctr) + RCU_GP_CTR;
+    WRITE_ONCE(rcu_data.gp_ctr, gp_ctr);
+
+    smp_mb();
+
+    /* Wait for the online threads which have not seen the new counter. */
+    for (node = rcu_data.head; node != NULL; node = node->next) {
+        while ((ctr = READ_ONCE(node->ctr)) && ctr != gp_ctr)
+            barrier();
+    }
+
+    spin_unlock(&rcu_data.sp);
+
+    smp_mb();
+
+    if (online)
+        rcu_thread_online();
+}
+
+#define rcu_dereference(p)                                                \
+    ({                                                                    \
+        __typeof__(*p) *__r_d_p = (__typeof__(*p) __force *)READ_ONCE(p); \
+        rcu_check_sparse(p, __rcu);                                       \
+        __r_d_p;                                                          \
+    })
+
+#define rcu_assign_pointer(p, v)                                              \
+    ({                                                                        \
+        __typeof__(*p) *__r_a_p =                                             \
+            (__typeof__(*p) __force *)__atomic_exchange_n(                    \
+                &(p), (__typeof__(*(p)) __force __rcu *)v, __ATOMIC_RELEASE); \
+        rcu_check_sparse(p, __rcu);                                           \
+        __r_a_p;                                                              \
+    })
+
+#endif /* __QSBR_RCU_H__ */
@@ -5,3 +5,18 @@ make -C thrd-based-rcu read
 ./locked-rcu/test
 echo "-------------------------"
 ./thrd-based-rcu/test
+echo "-------------------------"
+make -C thrd-based-rcu read CONFIG_MEMBARRIER=y
+./thrd-based-rcu/test
+echo "-------------------------"
+make -C qsbr-rcu read
+./qsbr-rcu/test
+echo "-------------------------"
+make -C ebr read
+./ebr/test
+echo "-------------------------"
+make -C user-lrcu read
+./user-lrcu/test
+echo "-------------------------"
+make -C user-lrcu read CONFIG_MEMBARRIER=y
+./user-lrcu/test
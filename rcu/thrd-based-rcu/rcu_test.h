@@ -0,0 +1,160 @@
+/*
+ * thrd-RCU test: The common fixture of the thrd-rcu tests
+ *
+ * The test object starts with struct test_head. It is alive from
+ * test_alloc() to test_free(), which poisons the magic before freeing it,
+ * so a reader reaching the object after the grace period sees the dead
+ * magic even without the sanitizer.
+ *
+ * test_run() runs the two groups of threads: the background threads loop
+ * until test_stopped(), the foreground threads do a fixed amount of work.
+ * It returns the time the foreground threads take.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#ifndef __RCU_TEST_H__
+#define __RCU_TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rculist.h"
+
+#define TEST_ALIVE 0x5a5a5a5a
+#define TEST_DEAD 0x0badf00d
+
+/* It must be the first member of the test object. */
+struct test_head {
+    int magic;
+    struct rcu_head rcu;
+};
+
+static unsigned long nr_violate;
+static int test_stop;
+
+static __inline__ void *__test_alloc(size_t size)
+{
+    struct test_head *th = (struct test_head *)malloc(size);
+    if (!th) {
+        fprintf(stderr, "test_alloc failed\n");
+        abort();
+    }
+
+    th->magic = TEST_ALIVE;
+
+    return th;
+}
+
+#define test_alloc(type) ((type *)__test_alloc(sizeof(type)))
+
+/* Mark the object dead without freeing it, so the memory is not reused by
+ * the next test_alloc() while the late readers may still look at it.
+ */
+static __inline__ void test_poison(void *obj)
+{
+    WRITE_ONCE(((struct test_head *)obj)->magic, TEST_DEAD);
+}
+
+static __inline__ void test_free(void *obj)
+{
+    test_poison(obj);
+    free(obj);
+}
+
+static __allow_unused void test_free_rcu(struct rcu_head *rcu)
+{
+    test_free(container_of(rcu, struct test_head, rcu));
+}
+
+/* Free the object after the grace period. */
+static __inline__ void test_call_rcu(void *obj)
+{
+    call_rcu(&((struct test_head *)obj)->rcu, test_free_rcu);
+}
+
+static __inline__ int test_dead(void *obj)
+{
+    return READ_ONCE(((struct test_head *)obj)->magic) != TEST_ALIVE;
+}
+
+static __inline__ void test_violate(unsigned long nr)
+{
+    if (nr)
+        __atomic_fetch_add(&nr_violate, nr, __ATOMIC_RELAXED);
+}
+
+static __inline__ int test_stopped(void)
+{
+    return READ_ONCE(test_stop);
+}
+
+static __inline__ double test_time(struct timespec *start,
+                                   struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+           (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* The argument of the background thread i is i, and the one of the
+ * foreground thread i is nr_bg + i, so they can seed the random numbers.
+ */
+static __inline__ double test_run(void *(*bg)(void *), int nr_bg,
+                                  void *(*fg)(void *), int nr_fg)
+{
+    pthread_t *thrd;
+    struct timespec start, end;
+    long i;
+
+    thrd = (pthread_t *)malloc(sizeof(pthread_t) * (nr_bg + nr_fg));
+    if (!thrd) {
+        fprintf(stderr, "test_run failed\n");
+        abort();
+    }
+
+    WRITE_ONCE(test_stop, 0);
+
+    for (i = 0; i < nr_bg; i++)
+        pthread_create(&thrd[i], NULL, bg, (void *)i);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = nr_bg; i < nr_bg + nr_fg; i++)
+        pthread_create(&thrd[i], NULL, fg, (void *)i);
+    for (i = nr_bg; i < nr_bg + nr_fg; i++)
+        pthread_join(thrd[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    WRITE_ONCE(test_stop, 1);
+    for (i = 0; i < nr_bg; i++)
+        pthread_join(thrd[i], NULL);
+
+    free(thrd);
+
+    return test_time(&start, &end);
+}
+
+/* Print the violations and return the exit code of the test. */
+static __inline__ int test_report(void)
+{
+    printf("%lu violation\n", nr_violate);
+    return nr_violate ? 1 : 0;
+}
+
+#endif /* __RCU_TEST_H__ */
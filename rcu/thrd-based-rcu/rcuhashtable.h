@@ -0,0 +1,331 @@
+/*
+ * thrd-RCU hash table: Resizable hash table on the thrd-rcu list
+ *
+ * Each bucket is a list of rculist.h. The readers look up without any lock
+ * in the read-side critical section. The updaters take the striped lock of
+ * the bucket, so the updates of the different stripes run in parallel.
+ *
+ * Every node has two links. The table uses one of them, and the resize
+ * links all the nodes into the new table by the other one while the readers
+ * keep walking the old table. Then it publishes the new table and waits for
+ * the grace period before freeing the old one. The resize holds all the
+ * stripe locks, so it blocks the updaters but never the readers.
+ *
+ * Since rcu_ht_insert() and rcu_ht_delete() may resize the table and wait
+ * for the grace period, they must be called outside the read-side critical
+ * section, or the updater waits for itself forever.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#ifndef __RCUHASHTABLE_H__
+#define __RCUHASHTABLE_H__
+
+#include <assert.h>
+#include "rculist.h"
+
+/* The number of the update locks, it should be power of 2. */
+#ifndef RCU_HT_NR_LOCK
+#define RCU_HT_NR_LOCK 64
+#endif
+
+/* Grow when the average chain is longer than RCU_HT_MAX_LOAD, shrink when
+ * it is shorter than RCU_HT_MIN_LOAD / 8. The table is never smaller than
+ * the locks, so each bucket is under exactly one of them.
+ */
+#define RCU_HT_MAX_LOAD 2
+#define RCU_HT_MIN_LOAD 1
+#define RCU_HT_MIN_SIZE RCU_HT_NR_LOCK
+
+struct rcu_ht_node {
+    struct list_head link[2];
+    unsigned long key;
+};
+
+struct rcu_ht_table {
+    unsigned long size;
+    int idx;
+    struct list_head bucket[];
+};
+
+struct rcu_ht {
+    struct rcu_ht_table __rcu *tbl;
+    unsigned long nr;
+    unsigned long nr_resize;
+    spinlock_t resize_lock;
+    spinlock_t lock[RCU_HT_NR_LOCK];
+};
+
+#define rcu_ht_entry(ptr, type, member) container_of(ptr, type, member)
+
+/* The list_head of the table to the node */
+#define __rcu_ht_node_of(n, idx)                                 \
+    ((struct rcu_ht_node *)((char *)((n) - (idx)) -              \
+                            offsetof(struct rcu_ht_node, link)))
+
+static __inline__ unsigned long rcu_ht_hash(unsigned long key)
+{
+    /* 64-bit golden ratio, the high bits are the better */
+    key *= 0x61c8864680b583ebUL;
+    return key ^ (key >> 32);
+}
+
+static __inline__ struct rcu_ht_table *__rcu_ht_table_alloc(unsigned long size,
+                                                            int idx)
+{
+    struct rcu_ht_table *tbl;
+    unsigned long i;
+
+    tbl = (struct rcu_ht_table *)malloc(sizeof(struct rcu_ht_table) +
+                                        sizeof(struct list_head) * size);
+    if (!tbl)
+        return NULL;
+
+    tbl->size = size;
+    tbl->idx = idx;
+    for (i = 0; i < size; i++)
+        list_init_rcu(&tbl->bucket[i]);
+
+    return tbl;
+}
+
+/* size should be power of 2 */
+static __inline__ int rcu_ht_init(struct rcu_ht *ht, unsigned long size)
+{
+    int i;
+
+    if (size < RCU_HT_MIN_SIZE)
+        size = RCU_HT_MIN_SIZE;
+
+    ht->tbl = (struct rcu_ht_table __rcu *)__rcu_ht_table_alloc(size, 0);
+    if (!ht->tbl)
+        return -ENOMEM;
+
+    ht->nr = 0;
+    ht->nr_resize = 0;
+    spin_lock_init(&ht->resize_lock);
+    for (i = 0; i < RCU_HT_NR_LOCK; i++)
+        spin_lock_init(&ht->lock[i]);
+
+    return 0;
+}
+
+static __inline__ struct list_head *__rcu_ht_bucket(struct rcu_ht_table *tbl,
+                                                    unsigned long key)
+{
+    return &tbl->bucket[rcu_ht_hash(key) & (tbl->size - 1)];
+}
+
+/* The bucket is always under the same lock whatever the size is, since
+ * both are power of 2 and the size is not less than RCU_HT_NR_LOCK.
+ */
+static __inline__ spinlock_t *__rcu_ht_lock_of(struct rcu_ht *ht,
+                                               unsigned long key)
+{
+    return &ht->lock[rcu_ht_hash(key) & (RCU_HT_NR_LOCK - 1)];
+}
+
+/* Lock the stripe of key. The table cannot be replaced while any stripe is
+ * held, so the table returned is stable until __rcu_ht_unlock().
+ */
+static __inline__ struct rcu_ht_table *__rcu_ht_lock(struct rcu_ht *ht,
+                                                     unsigned long key)
+{
+    spin_lock(__rcu_ht_lock_of(ht, key));
+    return rcu_uncheck(ht->tbl);
+}
+
+static __inline__ void __rcu_ht_unlock(struct rcu_ht *ht, unsigned long key)
+{
+    spin_unlock(__rcu_ht_lock_of(ht, key));
+}
+
+static __inline__ struct rcu_ht_node *
+__rcu_ht_find(struct rcu_ht_table *tbl, unsigned long key)
+{
+    struct list_head *head = __rcu_ht_bucket(tbl, key);
+    struct list_head *n;
+    struct rcu_ht_node *node;
+
+    list_for_each_rcu(n, head)
+    {
+        node = __rcu_ht_node_of(n, tbl->idx);
+        if (node->key == key)
+            return node;
+    }
+
+    return NULL;
+}
+
+/* It must be in the read-side critical section, the node returned is valid
+ * until rcu_read_unlock().
+ */
+static __inline__ struct rcu_ht_node *rcu_ht_lookup(struct rcu_ht *ht,
+                                                    unsigned long key)
+{
+    return __rcu_ht_find(rcu_dereference(ht->tbl), key);
+}
+
+static __inline__ int rcu_ht_resize(struct rcu_ht *ht, unsigned long size);
+
+/* The updates may wait for the grace period, not in the read-side. */
+static __inline__ void __rcu_ht_might_sync(void)
+{
+    assert(!__rcu_per_thrd_depth);
+}
+
+static __inline__ void __rcu_ht_check_load(struct rcu_ht *ht)
+{
+    struct rcu_ht_table *tbl;
+    unsigned long nr, size;
+
+    rcu_read_lock();
+    tbl = rcu_dereference(ht->tbl);
+    size = tbl->size;
+    rcu_read_unlock();
+
+    nr = __atomic_load_n(&ht->nr, __ATOMIC_RELAXED);
+    if (nr > size * RCU_HT_MAX_LOAD)
+        rcu_ht_resize(ht, size * 2);
+    else if (size > RCU_HT_MIN_SIZE && nr * 8 < size * RCU_HT_MIN_LOAD)
+        rcu_ht_resize(ht, size / 2);
+}
+
+/* Return -EEXIST if the key is already in the table. */
+static __inline__ int rcu_ht_insert(struct rcu_ht *ht, struct rcu_ht_node *node)
+{
+    struct rcu_ht_table *tbl;
+
+    __rcu_ht_might_sync();
+    tbl = __rcu_ht_lock(ht, node->key);
+
+    if (__rcu_ht_find(tbl, node->key)) {
+        __rcu_ht_unlock(ht, node->key);
+        return -EEXIST;
+    }
+    list_add_rcu(&node->link[tbl->idx], __rcu_ht_bucket(tbl, node->key));
+    __atomic_fetch_add(&ht->nr, 1, __ATOMIC_RELAXED);
+
+    __rcu_ht_unlock(ht, node->key);
+
+    __rcu_ht_check_load(ht);
+
+    return 0;
+}
+
+/* Unlink the node of key and return it, NULL if not found. The readers
+ * may still hold it, free it after the grace period.
+ */
+static __inline__ struct rcu_ht_node *rcu_ht_delete(struct rcu_ht *ht,
+                                                    unsigned long key)
+{
+    struct rcu_ht_table *tbl;
+    struct rcu_ht_node *node;
+
+    __rcu_ht_might_sync();
+    tbl = __rcu_ht_lock(ht, key);
+
+    node = __rcu_ht_find(tbl, key);
+    if (node) {
+        list_del_rcu(&node->link[tbl->idx]);
+        __atomic_fetch_sub(&ht->nr, 1, __ATOMIC_RELAXED);
+    }
+
+    __rcu_ht_unlock(ht, key);
+
+    if (node)
+        __rcu_ht_check_load(ht);
+
+    return node;
+}
+
+/* Link all the nodes to the new table by the other link. Only one resize
+ * at a time, return -EBUSY if another one is in progress.
+ */
+static __inline__ int rcu_ht_resize(struct rcu_ht *ht, unsigned long size)
+{
+    struct rcu_ht_table *old, *new;
+    struct rcu_ht_node *node;
+    struct list_head *n;
+    unsigned long i;
+
+    __rcu_ht_might_sync();
+    if (!spin_trylock(&ht->resize_lock))
+        return -EBUSY;
+
+    old = rcu_uncheck(ht->tbl);
+    if (size < RCU_HT_MIN_SIZE || size == old->size) {
+        spin_unlock(&ht->resize_lock);
+        return 0;
+    }
+
+    new = __rcu_ht_table_alloc(size, !old->idx);
+    if (!new) {
+        spin_unlock(&ht->resize_lock);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < RCU_HT_NR_LOCK; i++)
+        spin_lock(&ht->lock[i]);
+
+    /* The new table is not visible yet, the readers only walk the old
+     * links of the old table.
+     */
+    for (i = 0; i < old->size; i++) {
+        list_for_each(n, &old->bucket[i])
+        {
+            node = __rcu_ht_node_of(n, old->idx);
+            list_add_rcu(&node->link[new->idx],
+                         __rcu_ht_bucket(new, node->key));
+        }
+    }
+
+    rcu_assign_pointer(ht->tbl, new);
+    ht->nr_resize++;
+
+    for (i = 0; i < RCU_HT_NR_LOCK; i++)
+        spin_unlock(&ht->lock[i]);
+
+    /* The next resize reuses the old links, so hold the resize lock. */
+    synchronize_rcu();
+    free(old);
+
+    spin_unlock(&ht->resize_lock);
+
+    return 0;
+}
+
+/* The readers and the updaters should have finished. */
+static __inline__ void rcu_ht_destroy(struct rcu_ht *ht,
+                                      void (*func)(struct rcu_ht_node *node))
+{
+    struct rcu_ht_table *tbl = rcu_uncheck(ht->tbl);
+    struct list_head *n, *tmp;
+    unsigned long i;
+
+    for (i = 0; i < tbl->size; i++) {
+        list_for_each_safe(n, tmp, &tbl->bucket[i])
+        {
+            func(__rcu_ht_node_of(n, tbl->idx));
+        }
+    }
+
+    free(tbl);
+    ht->tbl = NULL;
+    ht->nr = 0;
+}
+
+#endif /* __RCUHASHTABLE_H__ */
@@ -28,8 +28,22 @@
         const __typeof__(((type *)0)->member) *__mptr = (ptr); \
         (type *)((char *)__mptr - offsetof(type, member));     \
     })
+
+/* The readers load the next pointers with consume, so the loads through
+ * them are ordered after the initialization of the node, which the updater
+ * publishes with release. GCC promotes consume to acquire.
+ */
+#define rcu_dereference_consume(p)                                      \
+    ({                                                                  \
+        __typeof__(*p) *__r_d_c_p =                                     \
+            (__typeof__(*p) __force *)__atomic_load_n(&(p),             \
+                                                      __ATOMIC_CONSUME); \
+        rcu_check_sparse(p, __rcu);                                     \
+        __r_d_c_p;                                                      \
+    })
+
 #define list_entry_rcu(ptr, type, member) \
-    container_of(READ_ONCE(ptr), type, member)
+    container_of(rcu_dereference_consume(ptr), type, member)
 
 #define list_next_rcu(n) (*((struct list_head __rcu **)(&(n)->next)))
 
@@ -45,6 +59,9 @@ static inline void list_init_rcu(struct list_head *node)
     node->prev = node;
 }
 
+/* The updates below allow only one updater at a time, serialize them by a
+ * lock or use rculist_lock.h for the concurrent updaters.
+ */
 static inline void __list_add_rcu(struct list_head *new, struct list_head *prev,
                                   struct list_head *next)
 {
@@ -74,18 +91,158 @@ static inline void __list_del_rcu(struct list_head *prev,
     rcu_assign_pointer(list_next_rcu(prev), next);
 }
 
+/* Replace old by new, the readers see either of them. Free old after the
+ * grace period.
+ */
+static inline void list_replace_rcu(struct list_head *old,
+                                    struct list_head *new)
+{
+    new->next = old->next;
+    new->prev = old->prev;
+    rcu_assign_pointer(list_next_rcu(new->prev), new);
+    new->next->prev = new;
+    old->prev = NULL;
+}
+
+/* The readers may still stand on the node, so keep its next pointer and
+ * let them go on. The node can be reused after the grace period.
+ */
 static inline void list_del_rcu(struct list_head *node)
 {
     __list_del_rcu(node->prev, node->next);
-    list_init_rcu(node);
+    node->prev = NULL;
 }
 
 #define list_for_each(n, head) for (n = (head)->next; n != (head); n = n->next)
 
+/* The iterators and accessors below must be in the read-side critical
+ * section.
+ */
+#define list_for_each_rcu(n, head)                                      \
+    for (n = rcu_dereference_consume(list_next_rcu(head)); n != (head); \
+         n = rcu_dereference_consume(list_next_rcu(n)))
+
+#define list_for_each_entry_rcu(pos, head, member)                         \
+    for (pos = list_entry_rcu(list_next_rcu(head), __typeof__(*pos),      \
+                              member);                                     \
+         &pos->member != (head);                                           \
+         pos = list_entry_rcu(list_next_rcu(&pos->member), __typeof__(*pos), \
+                              member))
+
+/* Return the entry after ptr, or NULL if ptr is the last one. */
+#define list_next_or_null_rcu(head, ptr, type, member)                  \
+    ({                                                                  \
+        struct list_head *__head = (head);                              \
+        struct list_head *__next =                                      \
+            rcu_dereference_consume(list_next_rcu(ptr));                \
+        __next != __head ? container_of(__next, type, member) : NULL;   \
+    })
+
+#define list_first_or_null_rcu(head, type, member) \
+    list_next_or_null_rcu(head, head, type, member)
+
 #define list_for_each_from(pos, head) for (; pos != (head); pos = pos->next)
 
 #define list_for_each_safe(pos, n, head)                   \
     for (pos = (head)->next, n = pos->next; pos != (head); \
          pos = n, n = pos->next)
 
+/* The hash list, the head is one pointer. pprev points to the next of the
+ * previous node or the first of the head, so the deletion does not need
+ * the head.
+ */
+struct hlist_node {
+    struct hlist_node *next;
+    struct hlist_node **pprev;
+};
+
+struct hlist_head {
+    struct hlist_node *first;
+};
+
+#define hlist_first_rcu(h) (*((struct hlist_node __rcu **)(&(h)->first)))
+#define hlist_next_rcu(n) (*((struct hlist_node __rcu **)(&(n)->next)))
+#define hlist_pprev_rcu(n) (*((struct hlist_node __rcu **)((n)->pprev)))
+
+static inline void hlist_init_head(struct hlist_head *h)
+{
+    h->first = NULL;
+}
+
+static inline void hlist_init_node(struct hlist_node *n)
+{
+    n->next = NULL;
+    n->pprev = NULL;
+}
+
+static inline int hlist_unhashed(const struct hlist_node *n)
+{
+    return !n->pprev;
+}
+
+static inline void hlist_add_head_rcu(struct hlist_node *n,
+                                      struct hlist_head *h)
+{
+    struct hlist_node *first = h->first;
+
+    n->next = first;
+    n->pprev = &h->first;
+    rcu_assign_pointer(hlist_first_rcu(h), n);
+    if (first)
+        first->pprev = &n->next;
+}
+
+/* Add n after prev */
+static inline void hlist_add_behind_rcu(struct hlist_node *n,
+                                        struct hlist_node *prev)
+{
+    n->next = prev->next;
+    n->pprev = &prev->next;
+    rcu_assign_pointer(hlist_next_rcu(prev), n);
+    if (n->next)
+        n->next->pprev = &n->next;
+}
+
+/* Keep the next pointer for the readers standing on it, see
+ * list_del_rcu().
+ */
+static inline void hlist_del_rcu(struct hlist_node *n)
+{
+    struct hlist_node *next = n->next;
+    struct hlist_node **pprev = n->pprev;
+
+    WRITE_ONCE(*pprev, next);
+    if (next)
+        next->pprev = pprev;
+    n->pprev = NULL;
+}
+
+static inline void hlist_replace_rcu(struct hlist_node *old,
+                                     struct hlist_node *new)
+{
+    struct hlist_node *next = old->next;
+
+    new->next = next;
+    new->pprev = old->pprev;
+    rcu_assign_pointer(hlist_pprev_rcu(new), new);
+    if (next)
+        next->pprev = &new->next;
+    old->pprev = NULL;
+}
+
+#define hlist_entry_safe(ptr, type, member)                          \
+    ({                                                               \
+        struct hlist_node *__h_e_p = (ptr);                          \
+        __h_e_p ? container_of(__h_e_p, type, member) : NULL;        \
+    })
+
+/* It must be in the read-side critical section. */
+#define hlist_for_each_entry_rcu(pos, head, member)                         \
+    for (pos = hlist_entry_safe(rcu_dereference_consume(hlist_first_rcu(head)), \
+                                __typeof__(*(pos)), member);                \
+         pos;                                                               \
+         pos = hlist_entry_safe(                                            \
+             rcu_dereference_consume(hlist_next_rcu(&(pos)->member)),       \
+             __typeof__(*(pos)), member))
+
 #endif /* __RCULIST_H__ */
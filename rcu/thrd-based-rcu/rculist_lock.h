@@ -0,0 +1,195 @@
+/*
+ * thrd-RCU list: The list of rculist.h for the concurrent updaters
+ *
+ * The primitives of rculist.h allow only one updater at a time. Here every
+ * node has its own lock, and an update locks only the nodes whose links it
+ * changes: the insertion locks the two neighbors, the deletion locks the
+ * node and its two neighbors. So the updates on the different parts of the
+ * list run in parallel. The readers are the same as rculist.h, they walk
+ * the list member with list_for_each_entry_rcu() without any lock.
+ *
+ * The first lock is blocking and the others are trylock. If any of them
+ * fails, the updater releases all and retries, so there is no lock order
+ * to follow around the circular list. The deleted node is marked dead under
+ * its lock, the updater validates the links after locking and retries if
+ * the neighbors have changed.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#ifndef __RCULIST_LOCK_H__
+#define __RCULIST_LOCK_H__
+
+#include <sched.h>
+#include "rculist.h"
+
+/* The head is a node which is never deleted. */
+struct list_lock_node {
+    struct list_head list;
+    spinlock_t lock;
+    int dead;
+};
+
+#define list_lock_entry(ptr) container_of(ptr, struct list_lock_node, list)
+
+static inline void list_lock_init(struct list_lock_node *node)
+{
+    list_init_rcu(&node->list);
+    spin_lock_init(&node->lock);
+    node->dead = 0;
+}
+
+static __inline__ void __list_unlock_nodes(struct list_lock_node **n, int nr)
+{
+    int i, j;
+
+    for (i = nr - 1; i >= 0; i--) {
+        for (j = 0; j < i; j++)
+            if (n[j] == n[i])
+                break;
+        if (j == i)
+            spin_unlock(&n[i]->lock);
+    }
+}
+
+/* Lock the nodes, the same node may appear more than once. Return 0 with
+ * nothing held if any trylock fails.
+ */
+static __inline__ int __list_lock_nodes(struct list_lock_node **n, int nr)
+{
+    int i, j;
+
+    spin_lock(&n[0]->lock);
+    for (i = 1; i < nr; i++) {
+        for (j = 0; j < i; j++)
+            if (n[j] == n[i])
+                break;
+        if (j == i && !spin_trylock(&n[i]->lock)) {
+            __list_unlock_nodes(n, i);
+            sched_yield();
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Add new after prev. Return -ENOENT if prev has been deleted. */
+static __inline__ int list_lock_add_rcu(struct list_lock_node *new,
+                                        struct list_lock_node *prev)
+{
+    struct list_lock_node *n[2];
+    int ret = 0;
+
+    /* The neighbors read before locking may be deleted, the read-side
+     * critical section keeps them from being freed.
+     */
+    rcu_read_lock();
+
+    for (;;) {
+        n[0] = prev;
+        n[1] = list_lock_entry(READ_ONCE(prev->list.next));
+        if (!__list_lock_nodes(n, 2))
+            continue;
+
+        if (prev->dead) {
+            ret = -ENOENT;
+            break;
+        }
+        if (prev->list.next == &n[1]->list)
+            break;
+        __list_unlock_nodes(n, 2);
+    }
+
+    if (!ret)
+        __list_add_rcu(&new->list, &prev->list, &n[1]->list);
+    __list_unlock_nodes(n, 2);
+
+    rcu_read_unlock();
+
+    return ret;
+}
+
+static __inline__ void list_lock_add_tail_rcu(struct list_lock_node *new,
+                                              struct list_lock_node *head)
+{
+    struct list_lock_node *n[2];
+
+    rcu_read_lock();
+
+    for (;;) {
+        n[0] = list_lock_entry(READ_ONCE(head->list.prev));
+        n[1] = head;
+        if (!__list_lock_nodes(n, 2))
+            continue;
+
+        if (!n[0]->dead && n[0]->list.next == &head->list)
+            break;
+        __list_unlock_nodes(n, 2);
+    }
+
+    __list_add_rcu(&new->list, &n[0]->list, &head->list);
+    __list_unlock_nodes(n, 2);
+
+    rcu_read_unlock();
+}
+
+/* Return -ENOENT if the node has been deleted by the others. The readers
+ * may still hold it, free it after the grace period.
+ */
+static __inline__ int list_lock_del_rcu(struct list_lock_node *node)
+{
+    struct list_lock_node *n[3];
+    struct list_head *prev;
+    int ret = 0;
+
+    rcu_read_lock();
+
+    for (;;) {
+        prev = READ_ONCE(node->list.prev);
+        if (!prev) {
+            ret = -ENOENT;
+            goto out;
+        }
+        n[0] = list_lock_entry(prev);
+        n[1] = node;
+        n[2] = list_lock_entry(READ_ONCE(node->list.next));
+        if (!__list_lock_nodes(n, 3))
+            continue;
+
+        if (node->dead) {
+            ret = -ENOENT;
+            break;
+        }
+        if (!n[0]->dead && n[0]->list.next == &node->list &&
+            node->list.next == &n[2]->list)
+            break;
+        __list_unlock_nodes(n, 3);
+    }
+
+    if (!ret) {
+        node->dead = 1;
+        list_del_rcu(&node->list);
+    }
+    __list_unlock_nodes(n, 3);
+
+out:
+    rcu_read_unlock();
+
+    return ret;
+}
+
+#endif /* __RCULIST_LOCK_H__ */
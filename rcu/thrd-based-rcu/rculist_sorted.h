@@ -0,0 +1,319 @@
+/*
+ * thrd-RCU sorted list: The ordered list with the range scan on rculist.h
+ *
+ * The nodes are kept in the ascending order of the key. The readers find
+ * the first node not less than the key with list_find_ge_rcu(), and walk
+ * the range by list_for_each_range_rcu(), both in the read-side critical
+ * section without any lock. The updaters are serialized by one lock.
+ *
+ * To avoid the full scan, the list has a sampled index, the array of every
+ * RCU_SL_STRIDE-th node. The reader binary searches it and starts walking
+ * from the node found. The index is never changed after published. The
+ * insertion leaves it alone, the index only becomes sparser. The deletion
+ * of an indexed node publishes a copy with the node replaced by its
+ * predecessor, so the reader never gets the node from the index after its
+ * grace period. The index is rebuilt after enough updates.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#ifndef __RCULIST_SORTED_H__
+#define __RCULIST_SORTED_H__
+
+#include <string.h>
+#include "rculist.h"
+
+/* One index entry for every RCU_SL_STRIDE nodes */
+#ifndef RCU_SL_STRIDE
+#define RCU_SL_STRIDE 32
+#endif
+
+struct rcu_sl_node {
+    struct list_head list;
+    unsigned long key;
+    /* In the current index, only the updater uses it */
+    int indexed;
+};
+
+struct rcu_sl_index {
+    unsigned long nr;
+    struct rcu_head rcu;
+    /* NULL stands for the head */
+    struct rcu_sl_node *node[];
+};
+
+struct rcu_sl {
+    struct list_head head;
+    struct rcu_sl_index __rcu *idx;
+    unsigned long nr;
+    /* The updates since the last rebuild */
+    unsigned long nr_update;
+    unsigned long nr_rebuild;
+    spinlock_t lock;
+};
+
+#define rcu_sl_entry(ptr, type, member) container_of(ptr, type, member)
+
+static __inline__ void rcu_sl_init(struct rcu_sl *sl)
+{
+    list_init_rcu(&sl->head);
+    sl->idx = NULL;
+    sl->nr = 0;
+    sl->nr_update = 0;
+    sl->nr_rebuild = 0;
+    spin_lock_init(&sl->lock);
+}
+
+static __inline__ struct rcu_sl_node *__rcu_sl_node(struct list_head *n)
+{
+    return container_of(n, struct rcu_sl_node, list);
+}
+
+/* The last node whose key is less than key, or the head. */
+static __inline__ struct list_head *__rcu_sl_start(struct rcu_sl *sl,
+                                                   unsigned long key)
+{
+    struct rcu_sl_index *idx = rcu_dereference(sl->idx);
+    struct rcu_sl_node *node;
+    unsigned long lo, hi, mid;
+
+    if (!idx || !idx->nr)
+        return &sl->head;
+
+    /* The entries are in the ascending order, find the last one < key. */
+    lo = 0;
+    hi = idx->nr;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        node = idx->node[mid];
+        if (!node || node->key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (!lo || !idx->node[lo - 1])
+        return &sl->head;
+    return &idx->node[lo - 1]->list;
+}
+
+/* Return the first node whose key is not less than key, NULL if there is
+ * none. It must be in the read-side critical section.
+ */
+static __inline__ struct rcu_sl_node *list_find_ge_rcu(struct rcu_sl *sl,
+                                                       unsigned long key)
+{
+    struct list_head *n = __rcu_sl_start(sl, key);
+    struct rcu_sl_node *node;
+
+    /* The deleted node of the index still links forward. */
+    for (n = rcu_dereference_consume(list_next_rcu(n)); n != &sl->head;
+         n = rcu_dereference_consume(list_next_rcu(n))) {
+        node = __rcu_sl_node(n);
+        if (node->key >= key)
+            return node;
+    }
+
+    return NULL;
+}
+
+static __inline__ struct rcu_sl_node *list_next_sorted_rcu(struct rcu_sl *sl,
+                                                           struct rcu_sl_node *node)
+{
+    return list_next_or_null_rcu(&sl->head, &node->list, struct rcu_sl_node,
+                                 list);
+}
+
+/* Walk the nodes whose keys are in [lo, hi]. It must be in the read-side
+ * critical section.
+ */
+#define list_for_each_range_rcu(pos, sl, lo, hi)                    \
+    for (pos = list_find_ge_rcu(sl, lo); pos && pos->key <= (hi); \
+         pos = list_next_sorted_rcu(sl, pos))
+
+static void __rcu_sl_index_free(struct rcu_head *rcu)
+{
+    free(container_of(rcu, struct rcu_sl_index, rcu));
+}
+
+/* Publish the new index, the caller frees the old one after the grace
+ * period. It needs the lock.
+ */
+static __inline__ struct rcu_sl_index *
+__rcu_sl_index_publish(struct rcu_sl *sl, struct rcu_sl_index *new)
+{
+    return rcu_assign_pointer(sl->idx, new);
+}
+
+/* Sample every RCU_SL_STRIDE-th node. Keep the old index if the
+ * allocation fails, it is still correct. It needs the lock.
+ */
+static __inline__ struct rcu_sl_index *__rcu_sl_rebuild(struct rcu_sl *sl)
+{
+    struct rcu_sl_index *new;
+    struct rcu_sl_node *node;
+    struct list_head *n;
+    unsigned long i = 0, nr = sl->nr / RCU_SL_STRIDE;
+
+    sl->nr_update = 0;
+
+    new = (struct rcu_sl_index *)malloc(sizeof(struct rcu_sl_index) +
+                                        sizeof(struct rcu_sl_node *) * nr);
+    if (!new)
+        return NULL;
+
+    new->nr = 0;
+    list_for_each(n, &sl->head)
+    {
+        node = __rcu_sl_node(n);
+        node->indexed = (++i % RCU_SL_STRIDE == 0) && new->nr < nr;
+        if (node->indexed)
+            new->node[new->nr++] = node;
+    }
+    sl->nr_rebuild++;
+
+    return __rcu_sl_index_publish(sl, new);
+}
+
+/* Replace the deleting node in the index by its predecessor. Fall back to
+ * the empty index if the allocation fails. It needs the lock.
+ */
+static __inline__ struct rcu_sl_index *
+__rcu_sl_unindex(struct rcu_sl *sl, struct rcu_sl_node *node)
+{
+    struct rcu_sl_index *old = rcu_uncheck(sl->idx), *new;
+    struct rcu_sl_node *prev = NULL;
+    unsigned long i;
+
+    if (!old)
+        return NULL;
+
+    if (node->list.prev != &sl->head) {
+        prev = __rcu_sl_node(node->list.prev);
+        prev->indexed = 1;
+    }
+
+    new = (struct rcu_sl_index *)malloc(sizeof(struct rcu_sl_index) +
+                                        sizeof(struct rcu_sl_node *) * old->nr);
+    if (!new)
+        return __rcu_sl_index_publish(sl, NULL);
+
+    new->nr = old->nr;
+    memcpy(new->node, old->node, sizeof(struct rcu_sl_node *) * old->nr);
+    for (i = 0; i < new->nr; i++)
+        if (new->node[i] == node)
+            new->node[i] = prev;
+
+    return __rcu_sl_index_publish(sl, new);
+}
+
+/* Rebuild after the updates have changed half of the list. Without the
+ * index, the lookups always walk the list from the head.
+ */
+static __inline__ struct rcu_sl_index *__rcu_sl_check_index(struct rcu_sl *sl)
+{
+#ifdef RCU_SL_NO_INDEX
+    return NULL;
+#else
+    if (++sl->nr_update * 2 < sl->nr || sl->nr_update < RCU_SL_STRIDE)
+        return NULL;
+    return __rcu_sl_rebuild(sl);
+#endif
+}
+
+static __inline__ void __rcu_sl_retire_index(struct rcu_sl_index *old)
+{
+    if (old)
+        call_rcu(&old->rcu, __rcu_sl_index_free);
+}
+
+/* Return -EEXIST if the key is already in the list. */
+static __inline__ int rcu_sl_insert(struct rcu_sl *sl, struct rcu_sl_node *new)
+{
+    struct rcu_sl_node *ge;
+    struct rcu_sl_index *old;
+
+    new->indexed = 0;
+
+    spin_lock(&sl->lock);
+
+    ge = list_find_ge_rcu(sl, new->key);
+    if (ge && ge->key == new->key) {
+        spin_unlock(&sl->lock);
+        return -EEXIST;
+    }
+    /* Add before ge, or to the tail */
+    list_add_tail_rcu(&new->list, ge ? &ge->list : &sl->head);
+    sl->nr++;
+    old = __rcu_sl_check_index(sl);
+
+    spin_unlock(&sl->lock);
+
+    __rcu_sl_retire_index(old);
+
+    return 0;
+}
+
+/* Unlink the node of key and return it, NULL if not found. The readers
+ * may still hold it, free it after the grace period.
+ */
+static __inline__ struct rcu_sl_node *rcu_sl_delete(struct rcu_sl *sl,
+                                                    unsigned long key)
+{
+    struct rcu_sl_node *node;
+    struct rcu_sl_index *old = NULL;
+
+    spin_lock(&sl->lock);
+
+    node = list_find_ge_rcu(sl, key);
+    if (!node || node->key != key) {
+        spin_unlock(&sl->lock);
+        return NULL;
+    }
+    if (node->indexed)
+        old = __rcu_sl_unindex(sl, node);
+    list_del_rcu(&node->list);
+    sl->nr--;
+    if (!old)
+        old = __rcu_sl_check_index(sl);
+    else
+        sl->nr_update++;
+
+    spin_unlock(&sl->lock);
+
+    __rcu_sl_retire_index(old);
+
+    return node;
+}
+
+/* The readers and the updaters should have finished. */
+static __inline__ void rcu_sl_destroy(struct rcu_sl *sl,
+                                      void (*func)(struct rcu_sl_node *node))
+{
+    struct list_head *n, *tmp;
+
+    list_for_each_safe(n, tmp, &sl->head)
+    {
+        func(__rcu_sl_node(n));
+    }
+    list_init_rcu(&sl->head);
+
+    free(rcu_uncheck(sl->idx));
+    sl->idx = NULL;
+    sl->nr = 0;
+}
+
+#endif /* __RCULIST_SORTED_H__ */
@@ -102,8 +102,15 @@ static __inline__ void benchmark(void)
 
 int main(int argc, char *argv[])
 {
-    printf("thrd rcu read side: reader %d, updater %d\n", READER_NUM,
-           UPDATER_NUM);
+    const char *fence = "smp_mb";
+
+#ifdef CONFIG_MEMBARRIER
+    if (rcu_membarrier_init() == 0)
+        fence = "membarrier";
+#endif
+
+    printf("thrd rcu read side: reader %d, updater %d, %s\n", READER_NUM,
+           UPDATER_NUM, fence);
     benchmark();
     return 0;
 }
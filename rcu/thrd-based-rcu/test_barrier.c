@@ -0,0 +1,142 @@
+/*
+ * rcu_barrier() test: Every thread waits for its own callbacks only
+ *
+ * Each thread queues a batch of callbacks, calls rcu_barrier() and checks
+ * all of them have been invoked. The background threads keep queueing the
+ * callbacks meanwhile, so the worker sweeps the queues while they grow; a
+ * barrier counting the callbacks of the other threads returns too early.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Let the threads queue while the worker is in the middle of the sweep. */
+#define rcu_worker_sweep_hook() sched_yield()
+#include "rcu_test.h"
+
+/* The threads queueing in the background */
+#ifndef NOISE_NUM
+#define NOISE_NUM 4
+#endif
+
+/* The callbacks of each batch */
+#ifndef BATCH_NR
+#define BATCH_NR 8
+#endif
+
+struct test {
+    struct test_head th;
+    unsigned long *done;
+};
+
+static void done_rcu(struct rcu_head *rcu)
+{
+    struct test *t = container_of(rcu, struct test, th.rcu);
+
+    __atomic_fetch_add(t->done, 1, __ATOMIC_RELAXED);
+    test_free(t);
+}
+
+/* The noise threads register after the others and the worker sweeps the
+ * slots in order, so their callbacks are taken behind ours in a sweep.
+ */
+static int nr_registered;
+
+static void *noise_side(void *argv)
+{
+    unsigned long done = 0, queued = 0;
+    struct test *t;
+
+    while (__atomic_load_n(&nr_registered, __ATOMIC_ACQUIRE) < READER_NUM)
+        usleep(RCU_WORKER_DELAY);
+    rcu_init();
+
+    while (!test_stopped()) {
+        /* Bound the callbacks in flight without rcu_barrier() */
+        if (queued - __atomic_load_n(&done, __ATOMIC_RELAXED) > 64 * BATCH_NR) {
+            sched_yield();
+            continue;
+        }
+        t = test_alloc(struct test);
+        t->done = &done;
+        call_rcu(&t->th.rcu, done_rcu);
+        queued++;
+    }
+
+    /* The callbacks still use done on our stack. */
+    while (__atomic_load_n(&done, __ATOMIC_RELAXED) != queued)
+        usleep(RCU_WORKER_DELAY);
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+static void *worker_side(void *argv)
+{
+    unsigned long done = 0, violate = 0;
+    struct test *t;
+    int i, j;
+
+    rcu_init();
+    __atomic_fetch_add(&nr_registered, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < TRACE_LOOP; i++) {
+        for (j = 0; j < BATCH_NR; j++) {
+            t = test_alloc(struct test);
+            t->done = &done;
+            call_rcu(&t->th.rcu, done_rcu);
+        }
+
+        rcu_barrier();
+        if (__atomic_load_n(&done, __ATOMIC_RELAXED) != (i + 1) * BATCH_NR)
+            violate++;
+    }
+
+    /* The callbacks still use done on our stack. */
+    while (__atomic_load_n(&done, __ATOMIC_RELAXED) != TRACE_LOOP * BATCH_NR)
+        rcu_barrier();
+
+    test_violate(violate);
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    double during;
+
+    rcu_init();
+    rcu_worker_start();
+
+    during = test_run(noise_side, NOISE_NUM, worker_side, READER_NUM);
+
+    rcu_worker_stop();
+    rcu_clean();
+
+    printf("thrd rcu barrier: thread %d, noise %d, %d batches of %d "
+           "callbacks, %.0f barriers/sec\n",
+           READER_NUM, NOISE_NUM, TRACE_LOOP, BATCH_NR,
+           READER_NUM * TRACE_LOOP / during);
+
+    return test_report();
+}
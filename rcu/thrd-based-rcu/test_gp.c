@@ -0,0 +1,118 @@
+/*
+ * Grace period stress test: preempt the readers inside rcu_read_lock()
+ *
+ * The reader is put to sleep between picking its slot and setting it, so
+ * the grace periods flip the index in the window. Then it holds the object
+ * for a while. If a grace period misses the reader, the updater frees the
+ * object it holds and the reader sees the poisoned magic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The sleep in the window and in the critical section, in microseconds */
+#ifndef PICK_DELAY
+#define PICK_DELAY 200
+#endif
+
+static void test_pick_delay(void)
+{
+    usleep(PICK_DELAY);
+}
+
+#define rcu_read_lock_pick_hook() test_pick_delay()
+#include "rcu_test.h"
+
+struct test {
+    struct test_head th;
+};
+
+/* The poisoned objects are freed GRAVE_NR grace periods later, malloc()
+ * would reuse them at once and hide the poison.
+ */
+#define GRAVE_NR 1024
+
+static struct test __rcu *foo;
+static struct test *grave[GRAVE_NR];
+static unsigned long nr_gp;
+
+static void *reader_side(void *argv)
+{
+    struct test *tmp;
+    unsigned long violate = 0;
+    int i;
+
+    rcu_init();
+
+    for (i = 0; i < TRACE_LOOP; i++) {
+        rcu_read_lock();
+
+        tmp = rcu_dereference(foo);
+        usleep(PICK_DELAY);
+        violate += test_dead(tmp);
+
+        rcu_read_unlock();
+    }
+
+    test_violate(violate);
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+static void *updater_side(void *argv)
+{
+    struct test *oldp;
+    unsigned long gp = 0;
+
+    while (!test_stopped()) {
+        oldp = rcu_assign_pointer(foo, test_alloc(struct test));
+        synchronize_rcu();
+        test_poison(oldp);
+        free(grave[gp % GRAVE_NR]);
+        grave[gp % GRAVE_NR] = oldp;
+        gp++;
+    }
+
+    __atomic_fetch_add(&nr_gp, gp, __ATOMIC_RELAXED);
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    rcu_init();
+    foo = (struct test __rcu *)test_alloc(struct test);
+
+    test_run(updater_side, UPDATER_NUM, reader_side, READER_NUM);
+
+    for (i = 0; i < GRAVE_NR; i++)
+        free(grave[i]);
+    test_free(rcu_uncheck(foo));
+    rcu_clean();
+
+    printf("thrd rcu grace period: reader %d, updater %d, loop %d, "
+           "%lu grace periods\n",
+           READER_NUM, UPDATER_NUM, TRACE_LOOP, nr_gp);
+
+    return test_report();
+}
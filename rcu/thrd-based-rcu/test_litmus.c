@@ -0,0 +1,234 @@
+/*
+ * thrd-RCU list: A litmus-style stress test of the list primitives
+ *
+ * The updater keeps inserting, replacing and deleting the random nodes of
+ * one list and one hash list, while the readers walk both of them and check
+ * every node they reach. A node is initialized before it is published and
+ * poisoned when it is freed after the grace period, so the reader catches
+ * both the missing publish ordering and the too early free. The test fails
+ * if any reader sees a bad node.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rcu_test.h"
+
+/* The number of the nodes the updater keeps around */
+#ifndef LIST_LEN
+#define LIST_LEN 64
+#endif
+
+struct test {
+    struct test_head th;
+    unsigned long val;
+    unsigned long check;
+    struct list_head node;
+    struct hlist_node hnode;
+};
+
+static struct list_head head;
+static struct hlist_head hhead;
+
+static unsigned long nr_walk;
+static unsigned long nr_visit;
+
+/* Only the updater touches it */
+static struct test *slot[LIST_LEN];
+static int nr_slot;
+
+static struct test *test_new(unsigned long val)
+{
+    struct test *new = test_alloc(struct test);
+
+    new->val = val;
+    new->check = ~val;
+
+    return new;
+}
+
+/* Break the pair too, the readers see it even when the magic survives the
+ * free.
+ */
+static void test_poison_free(struct test *t)
+{
+    WRITE_ONCE(t->check, t->val);
+    test_free(t);
+}
+
+#ifdef CONFIG_CALL_RCU
+static void free_rcu(struct rcu_head *rcu)
+{
+    test_poison_free(container_of(rcu, struct test, th.rcu));
+}
+#endif
+
+static __inline__ void test_retire(struct test *t)
+{
+#ifdef CONFIG_CALL_RCU
+    call_rcu(&t->th.rcu, free_rcu);
+#else
+    synchronize_rcu();
+    test_poison_free(t);
+#endif
+}
+
+static __inline__ int test_bad(struct test *t)
+{
+    return test_dead(t) || READ_ONCE(t->check) != ~READ_ONCE(t->val);
+}
+
+static void *reader_side(void *argv)
+{
+    struct test *t;
+    unsigned long walk = 0, visit = 0, bad = 0;
+
+    rcu_init();
+
+    while (!test_stopped()) {
+        rcu_read_lock();
+
+        list_for_each_entry_rcu(t, &head, node)
+        {
+            bad += test_bad(t);
+            visit++;
+        }
+
+        t = list_first_or_null_rcu(&head, struct test, node);
+        while (t) {
+            bad += test_bad(t);
+            visit++;
+            t = list_next_or_null_rcu(&head, &t->node, struct test, node);
+        }
+
+        hlist_for_each_entry_rcu(t, &hhead, hnode)
+        {
+            bad += test_bad(t);
+            visit++;
+        }
+
+        rcu_read_unlock();
+        walk++;
+    }
+
+    __atomic_fetch_add(&nr_walk, walk, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&nr_visit, visit, __ATOMIC_RELAXED);
+    test_violate(bad);
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+/* Insert behind a random node, or at the head if there is none. */
+static __inline__ void test_insert(unsigned long val, unsigned int *seed)
+{
+    struct test *new = test_new(val);
+    struct test *prev = nr_slot ? slot[rand_r(seed) % nr_slot] : NULL;
+
+    if (prev) {
+        list_add_rcu(&new->node, &prev->node);
+        hlist_add_behind_rcu(&new->hnode, &prev->hnode);
+    } else {
+        list_add_rcu(&new->node, &head);
+        hlist_add_head_rcu(&new->hnode, &hhead);
+    }
+    slot[nr_slot++] = new;
+}
+
+static __inline__ void test_replace(unsigned long val, unsigned int *seed)
+{
+    int i = rand_r(seed) % nr_slot;
+    struct test *old = slot[i];
+    struct test *new = test_new(val);
+
+    list_replace_rcu(&old->node, &new->node);
+    hlist_replace_rcu(&old->hnode, &new->hnode);
+    slot[i] = new;
+
+    test_retire(old);
+}
+
+static __inline__ void test_delete(unsigned int *seed)
+{
+    int i = rand_r(seed) % nr_slot;
+    struct test *old = slot[i];
+
+    list_del_rcu(&old->node);
+    hlist_del_rcu(&old->hnode);
+    slot[i] = slot[--nr_slot];
+
+    test_retire(old);
+}
+
+static void *updater_side(void *argv)
+{
+    unsigned int seed = (unsigned int)time(NULL);
+    int i, op;
+
+    rcu_init();
+
+    for (i = 0; i < UPDATE_NUM; i++) {
+        op = rand_r(&seed) % 3;
+        if (nr_slot == 0 || (op == 0 && nr_slot < LIST_LEN))
+            test_insert(i, &seed);
+        else if (op == 1 || nr_slot == LIST_LEN)
+            test_replace(i, &seed);
+        else
+            test_delete(&seed);
+    }
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mode = "synchronize_rcu";
+    int i;
+
+#ifdef CONFIG_CALL_RCU
+    mode = "call_rcu";
+#endif
+    printf("thrd rcu litmus: reader %d, %d updates, list length %d, %s\n",
+           READER_NUM, UPDATE_NUM, LIST_LEN, mode);
+
+    rcu_init();
+    list_init_rcu(&head);
+    hlist_init_head(&hhead);
+#ifdef CONFIG_CALL_RCU
+    rcu_worker_start();
+#endif
+
+    test_run(reader_side, READER_NUM, updater_side, 1);
+
+#ifdef CONFIG_CALL_RCU
+    rcu_worker_stop();
+#endif
+
+    printf("%lu walks, %lu nodes checked\n", nr_walk, nr_visit);
+
+    for (i = 0; i < nr_slot; i++)
+        test_poison_free(slot[i]);
+    rcu_clean();
+
+    return test_report();
+}
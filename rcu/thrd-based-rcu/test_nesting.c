@@ -0,0 +1,105 @@
+/*
+ * Nesting stress test: nested read-side critical sections of thrd-based RCU
+ *
+ * The readers hold the object of every nesting level and check them after
+ * the inner unlock. The updater replaces and frees the object as fast as it
+ * can, it poisons the object before freeing it, so an inner unlock ending
+ * the grace period early is caught even without the sanitizer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rcu_test.h"
+
+#ifndef NEST_DEPTH
+#define NEST_DEPTH 4
+#endif
+
+struct test {
+    struct test_head th;
+};
+
+static struct test __rcu *foo;
+
+static int read_nested(int depth)
+{
+    struct test *tmp;
+    int ret = 0;
+
+    rcu_read_lock();
+
+    tmp = rcu_dereference(foo);
+    if (depth > 1)
+        ret = read_nested(depth - 1);
+
+    /* The inner sections have unlocked, the outer one still holds tmp. */
+    ret += test_dead(tmp);
+
+    rcu_read_unlock();
+
+    return ret;
+}
+
+static void *reader_side(void *argv)
+{
+    unsigned long violate = 0;
+    int i;
+
+    rcu_init();
+
+    for (i = 0; i < TRACE_LOOP; i++)
+        violate += read_nested(1 + i % NEST_DEPTH);
+
+    test_violate(violate);
+
+    pthread_exit(NULL);
+}
+
+static void *updater_side(void *argv)
+{
+    struct test *oldp, *newval;
+
+    while (!test_stopped()) {
+        newval = test_alloc(struct test);
+
+        oldp = rcu_assign_pointer(foo, newval);
+
+        synchronize_rcu();
+        test_free(oldp);
+    }
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    foo = (struct test __rcu *)test_alloc(struct test);
+
+    /* The updaters keep replacing until the readers finish. */
+    test_run(updater_side, UPDATER_NUM, reader_side, READER_NUM);
+
+    test_free(rcu_uncheck(foo));
+
+    rcu_clean();
+
+    printf("thrd rcu nesting: reader %d, updater %d, depth %d, loop %d\n",
+           READER_NUM, UPDATER_NUM, NEST_DEPTH, TRACE_LOOP);
+
+    return test_report();
+}
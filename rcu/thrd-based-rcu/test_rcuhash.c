@@ -0,0 +1,313 @@
+/*
+ * thrd-RCU hash table: A mixed workload benchmark of the hash table
+ *
+ * Each thread looks up, inserts and deletes the random keys in KEY_RANGE,
+ * LOOKUP_PERCENT of the operations are the lookup and the rest are split
+ * between the insert and delete evenly. The table starts from the minimum
+ * size and resizes itself online. With CONFIG_HASH_MUTEX=y a plain chained
+ * hash table under one mutex, resized at the same load, is the baseline.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rcuhashtable.h"
+#include "rcu_test.h"
+
+#ifndef KEY_RANGE
+#define KEY_RANGE 16384
+#endif
+
+#ifndef HASH_OPS
+#define HASH_OPS 100000
+#endif
+
+#ifndef LOOKUP_PERCENT
+#define LOOKUP_PERCENT 90
+#endif
+
+#ifdef CONFIG_HASH_MUTEX
+/* The baseline: a plain chained hash table, everything is under the mutex,
+ * so the deleted node can be freed at once.
+ */
+struct test {
+    struct test_head th;
+    struct test *next;
+    unsigned long key;
+};
+
+static struct {
+    struct test **bucket;
+    unsigned long size;
+    unsigned long nr;
+    unsigned long nr_resize;
+    pthread_mutex_t lock;
+} ht = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct test **ht_bucket(unsigned long key)
+{
+    return &ht.bucket[rcu_ht_hash(key) & (ht.size - 1)];
+}
+
+static struct test **ht_find(unsigned long key)
+{
+    struct test **pp;
+
+    for (pp = ht_bucket(key); *pp; pp = &(*pp)->next) {
+        if ((*pp)->key == key)
+            break;
+    }
+
+    return pp;
+}
+
+static int ht_init(unsigned long size)
+{
+    ht.bucket = (struct test **)calloc(size, sizeof(struct test *));
+    if (!ht.bucket)
+        return -ENOMEM;
+    ht.size = size;
+
+    return 0;
+}
+
+static void ht_resize(unsigned long size)
+{
+    struct test **old = ht.bucket, *t, *next;
+    unsigned long i, old_size = ht.size;
+
+    if (ht_init(size))
+        return;
+
+    for (i = 0; i < old_size; i++) {
+        for (t = old[i]; t; t = next) {
+            next = t->next;
+            t->next = *ht_bucket(t->key);
+            *ht_bucket(t->key) = t;
+        }
+    }
+    free(old);
+    ht.nr_resize++;
+}
+
+static void ht_check_load(void)
+{
+    if (ht.nr > ht.size * RCU_HT_MAX_LOAD)
+        ht_resize(ht.size * 2);
+    else if (ht.size > RCU_HT_MIN_SIZE &&
+             ht.nr * 8 < ht.size * RCU_HT_MIN_LOAD)
+        ht_resize(ht.size / 2);
+}
+
+static __inline__ void ht_lookup(unsigned long key)
+{
+    struct test *t;
+
+    pthread_mutex_lock(&ht.lock);
+
+    t = *ht_find(key);
+    if (t && (test_dead(t) || t->key != key))
+        test_violate(1);
+
+    pthread_mutex_unlock(&ht.lock);
+}
+
+static __inline__ void ht_insert(unsigned long key)
+{
+    struct test *t = test_alloc(struct test);
+    struct test **pp;
+
+    t->key = key;
+
+    pthread_mutex_lock(&ht.lock);
+    pp = ht_find(key);
+    if (!*pp) {
+        t->next = NULL;
+        *pp = t;
+        ht.nr++;
+        ht_check_load();
+        t = NULL;
+    }
+    pthread_mutex_unlock(&ht.lock);
+
+    free(t);
+}
+
+static __inline__ void ht_delete(unsigned long key)
+{
+    struct test **pp, *t;
+
+    pthread_mutex_lock(&ht.lock);
+    pp = ht_find(key);
+    t = *pp;
+    if (t) {
+        *pp = t->next;
+        ht.nr--;
+        ht_check_load();
+    }
+    pthread_mutex_unlock(&ht.lock);
+
+    if (t)
+        test_free(t);
+}
+
+static void ht_destroy(void)
+{
+    struct test *t, *next;
+    unsigned long i;
+
+    for (i = 0; i < ht.size; i++) {
+        for (t = ht.bucket[i]; t; t = next) {
+            next = t->next;
+            test_free(t);
+        }
+    }
+    free(ht.bucket);
+}
+
+#define ht_nr() (ht.nr)
+#define ht_size() (ht.size)
+#define ht_nr_resize() (ht.nr_resize)
+#else
+struct test {
+    struct test_head th;
+    struct rcu_ht_node ht;
+};
+
+static struct rcu_ht ht;
+
+static void free_ht(struct rcu_ht_node *node)
+{
+    test_free(rcu_ht_entry(node, struct test, ht));
+}
+
+static int ht_init(unsigned long size)
+{
+    return rcu_ht_init(&ht, size);
+}
+
+static __inline__ void ht_lookup(unsigned long key)
+{
+    struct rcu_ht_node *node;
+    struct test *t;
+
+    rcu_read_lock();
+
+    node = rcu_ht_lookup(&ht, key);
+    if (node) {
+        t = rcu_ht_entry(node, struct test, ht);
+        if (test_dead(t) || node->key != key)
+            test_violate(1);
+    }
+
+    rcu_read_unlock();
+}
+
+static __inline__ void ht_insert(unsigned long key)
+{
+    struct test *t = test_alloc(struct test);
+
+    t->ht.key = key;
+
+    if (rcu_ht_insert(&ht, &t->ht))
+        free(t);
+}
+
+static __inline__ void ht_delete(unsigned long key)
+{
+    struct rcu_ht_node *node;
+
+    node = rcu_ht_delete(&ht, key);
+    if (node)
+        test_call_rcu(rcu_ht_entry(node, struct test, ht));
+}
+
+static void ht_destroy(void)
+{
+    rcu_ht_destroy(&ht, free_ht);
+}
+
+#define ht_nr() (ht.nr)
+#define ht_size() (rcu_uncheck(ht.tbl)->size)
+#define ht_nr_resize() (ht.nr_resize)
+#endif
+
+static void *worker_side(void *argv)
+{
+    unsigned int seed = (unsigned int)(unsigned long)argv;
+    unsigned long key;
+    int i, op;
+
+    rcu_init();
+
+    for (i = 0; i < HASH_OPS; i++) {
+        key = rand_r(&seed) % KEY_RANGE;
+        op = rand_r(&seed) % 100;
+        if (op < LOOKUP_PERCENT)
+            ht_lookup(key);
+        else if (op % 2)
+            ht_insert(key);
+        else
+            ht_delete(key);
+    }
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    double during;
+    long i;
+
+#ifdef CONFIG_HASH_MUTEX
+    printf("mutex hash table: ");
+#else
+    printf("thrd rcu hash table: ");
+#endif
+    printf("thread %d, key range %d, %d%% lookup\n", READER_NUM, KEY_RANGE,
+           LOOKUP_PERCENT);
+
+    rcu_init();
+    if (ht_init(RCU_HT_MIN_SIZE)) {
+        fprintf(stderr, "ht_init failed\n");
+        return -1;
+    }
+    for (i = 0; i < KEY_RANGE; i += 2)
+        ht_insert(i);
+#ifndef CONFIG_HASH_MUTEX
+    rcu_worker_start();
+#endif
+
+    during = test_run(NULL, 0, worker_side, READER_NUM);
+
+#ifndef CONFIG_HASH_MUTEX
+    rcu_worker_stop();
+#endif
+
+    printf("%.0f ops/sec, %lu keys, size %lu, %lu resizes\n",
+           (double)READER_NUM * HASH_OPS / during, ht_nr(), ht_size(),
+           ht_nr_resize());
+
+    ht_destroy();
+    rcu_clean();
+
+    return test_report();
+}
@@ -1,6 +1,12 @@
 /* 
  * thrd-RCU list: A benchmark of thrd-rcu linked list
  *
+ * The updaters insert and delete the nodes at the random positions of the
+ * list while the readers keep walking it. By default the updaters use the
+ * per-node locks of rculist_lock.h, with CONFIG_LIST_MUTEX=y they are
+ * serialized by one mutex for comparison. The number of the updaters is
+ * swept from 1 to UPDATER_NUM.
+ *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation, either version 3 of the License, or
@@ -18,101 +24,162 @@
  */
 
 #define _GNU_SOURCE
-#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
 
-#include "rculist.h"
+#include "rculist_lock.h"
+#include "rcu_test.h"
+
+/* The number of the nodes each updater keeps in the list */
+#ifndef LIST_LEN
+#define LIST_LEN 64
+#endif
 
 struct test {
+    struct test_head th;
     int count;
-    struct list_head node;
+    struct list_lock_node node;
 };
 
-static struct list_head head;
+static struct list_lock_node head;
+static unsigned long nr_walk;
+
+#ifdef CONFIG_LIST_MUTEX
+static DEFINE_SPINLOCK(list_lock);
 
-static struct test *test_alloc(int val)
+static __inline__ void list_insert(struct test *new, struct list_lock_node *prev)
 {
-    struct test *new = (struct test *)malloc(sizeof(struct test));
-    if (!new) {
-        fprintf(stderr, "test_alloc failed\n");
-        abort();
-    }
+    spin_lock(&list_lock);
+    list_add_rcu(&new->node.list, &prev->list);
+    spin_unlock(&list_lock);
+}
+
+static __inline__ void list_delete(struct test *old)
+{
+    spin_lock(&list_lock);
+    list_del_rcu(&old->node.list);
+    spin_unlock(&list_lock);
+}
+#else
+static __inline__ void list_insert(struct test *new, struct list_lock_node *prev)
+{
+    /* Only the owner deletes prev, so it is still in the list. */
+    list_lock_add_rcu(&new->node, prev);
+}
+
+static __inline__ void list_delete(struct test *old)
+{
+    list_lock_del_rcu(&old->node);
+}
+#endif
+
+static struct test *test_new(int val)
+{
+    struct test *new = test_alloc(struct test);
 
     new->count = val;
-    list_init_rcu(&new->node);
+    list_lock_init(&new->node);
 
     return new;
 }
 
 static void *reader_side(void *argv)
 {
-    struct test __allow_unused *tmp;
-    struct list_head *node;
+    struct test *tmp;
+    unsigned long walk = 0, bad = 0;
 
     rcu_init();
 
-    rcu_read_lock();
+    while (!test_stopped()) {
+        rcu_read_lock();
 
-    list_for_each(node, &head)
-    {
-        tmp = list_entry_rcu(node, struct test, node);
+        list_for_each_entry_rcu(tmp, &head.list, node.list)
+        {
+            bad += test_dead(tmp);
+        }
+
+        rcu_read_unlock();
+        walk++;
     }
 
-    rcu_read_unlock();
+    __atomic_fetch_add(&nr_walk, walk, __ATOMIC_RELAXED);
+    test_violate(bad);
+
+    rcu_unregister_thread();
 
     pthread_exit(NULL);
 }
 
+/* Each updater inserts behind and deletes its own nodes, which spread over
+ * the whole list.
+ */
 static void *updater_side(void *argv)
 {
-    struct test *newval = test_alloc(current_tid());
+    unsigned int seed = (unsigned int)(unsigned long)argv;
+    struct test *own[LIST_LEN], *t;
+    int i, nr = 0, idx;
 
-    list_add_tail_rcu(&newval->node, &head);
-    synchronize_rcu();
+    rcu_init();
+
+    for (i = 0; i < UPDATE_NUM; i++) {
+        if (nr == 0 || (rand_r(&seed) % 2 && nr < LIST_LEN)) {
+            t = test_new(current_tid());
+            list_insert(t, nr ? &own[rand_r(&seed) % nr]->node : &head);
+            own[nr++] = t;
+        } else {
+            idx = rand_r(&seed) % nr;
+            t = own[idx];
+            own[idx] = own[--nr];
+            list_delete(t);
+            test_call_rcu(t);
+        }
+    }
+
+    rcu_unregister_thread();
 
     pthread_exit(NULL);
 }
 
-static __inline__ void benchmark(void)
+static __inline__ void benchmark(int nr_updater)
 {
-    pthread_t reader[READER_NUM];
-    pthread_t updater[UPDATER_NUM];
     struct list_head *node, *pos;
-    struct test *tmp;
-    int i;
-    list_init_rcu(&head);
-
-    for (i = 0; i < READER_NUM / 2; i++)
-        pthread_create(&reader[i], NULL, reader_side, NULL);
-
-    for (i = 0; i < UPDATER_NUM; i++)
-        pthread_create(&updater[i], NULL, updater_side, NULL);
+    double during;
 
-    for (i = READER_NUM / 2; i < READER_NUM; i++)
-        pthread_create(&reader[i], NULL, reader_side, NULL);
+    nr_walk = 0;
+    list_lock_init(&head);
 
-    for (i = 0; i < READER_NUM; i++)
-        pthread_join(reader[i], NULL);
+    during = test_run(reader_side, READER_NUM, updater_side, nr_updater);
 
-    for (i = 0; i < UPDATER_NUM; i++)
-        pthread_join(updater[i], NULL);
+    printf("updater %d: %.0f updates/sec, %.0f walks/sec\n", nr_updater,
+           (double)nr_updater * UPDATE_NUM / during, nr_walk / during);
 
-    list_for_each_safe(pos, node, &head)
+    list_for_each_safe(pos, node, &head.list)
     {
-        tmp = container_of(pos, struct test, node);
-        free(tmp);
+        test_free(container_of(pos, struct test, node.list));
     }
-    list_init_rcu(&head);
-
-    rcu_clean();
 }
 
-#include "../trace_timer.h"
-
 int main(int argc, char *argv[])
 {
-    time_check_loop(benchmark(), TRACE_LOOP);
-    return 0;
+    int i;
+
+#ifdef CONFIG_LIST_MUTEX
+    printf("mutex list: ");
+#else
+    printf("per-node lock list: ");
+#endif
+    printf("reader %d, updater %d, %d nodes per updater\n", READER_NUM,
+           UPDATER_NUM, LIST_LEN);
+
+    rcu_init();
+    rcu_worker_start();
+
+    for (i = 1; i < UPDATER_NUM; i *= 2)
+        benchmark(i);
+    benchmark(UPDATER_NUM);
+
+    rcu_worker_stop();
+    rcu_clean();
+
+    return test_report();
 }
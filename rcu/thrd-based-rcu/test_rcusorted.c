@@ -0,0 +1,168 @@
+/*
+ * thrd-RCU sorted list: A range scan benchmark of the sorted list
+ *
+ * The readers scan the random ranges of RANGE_LEN keys while the updaters
+ * insert and delete the random keys in KEY_RANGE. Every scan checks the
+ * keys are ascending and the nodes are alive. With CONFIG_SORTED_NO_INDEX=y
+ * the readers start every scan from the head for comparison.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rculist_sorted.h"
+#include "rcu_test.h"
+
+#ifndef KEY_RANGE
+#define KEY_RANGE 65536
+#endif
+
+#ifndef RANGE_LEN
+#define RANGE_LEN 64
+#endif
+
+struct test {
+    struct test_head th;
+    struct rcu_sl_node sl;
+};
+
+static struct rcu_sl sl;
+static unsigned long nr_scan;
+static unsigned long nr_visit;
+
+static struct test *test_new(unsigned long key)
+{
+    struct test *new = test_alloc(struct test);
+
+    new->sl.key = key;
+
+    return new;
+}
+
+static void free_sl(struct rcu_sl_node *node)
+{
+    test_free(rcu_sl_entry(node, struct test, sl));
+}
+
+static void *reader_side(void *argv)
+{
+    unsigned int seed = (unsigned int)(unsigned long)argv;
+    unsigned long scan = 0, visit = 0, bad = 0;
+    unsigned long lo, last;
+    struct rcu_sl_node *pos;
+    struct test *t;
+    int first;
+
+    rcu_init();
+
+    while (!test_stopped()) {
+        lo = rand_r(&seed) % KEY_RANGE;
+        first = 1;
+        last = 0;
+
+        rcu_read_lock();
+
+        list_for_each_range_rcu(pos, &sl, lo, lo + RANGE_LEN - 1)
+        {
+            t = rcu_sl_entry(pos, struct test, sl);
+            if (test_dead(t) || pos->key < lo ||
+                (!first && pos->key <= last))
+                bad++;
+            first = 0;
+            last = pos->key;
+            visit++;
+        }
+
+        rcu_read_unlock();
+        scan++;
+    }
+
+    __atomic_fetch_add(&nr_scan, scan, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&nr_visit, visit, __ATOMIC_RELAXED);
+    test_violate(bad);
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+static void *updater_side(void *argv)
+{
+    unsigned int seed = (unsigned int)(unsigned long)argv;
+    struct rcu_sl_node *node;
+    struct test *t;
+    unsigned long key;
+    int i;
+
+    rcu_init();
+
+    for (i = 0; i < UPDATE_NUM; i++) {
+        key = rand_r(&seed) % KEY_RANGE;
+        if (i % 2) {
+            t = test_new(key);
+            if (rcu_sl_insert(&sl, &t->sl))
+                free(t);
+        } else {
+            node = rcu_sl_delete(&sl, key);
+            if (node)
+                test_call_rcu(rcu_sl_entry(node, struct test, sl));
+        }
+    }
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    struct test *t;
+    double during;
+    long i;
+
+#ifdef RCU_SL_NO_INDEX
+    printf("sorted list without index: ");
+#else
+    printf("sorted list, index stride %d: ", RCU_SL_STRIDE);
+#endif
+    printf("reader %d, updater %d, key range %d, range %d\n", READER_NUM,
+           UPDATER_NUM, KEY_RANGE, RANGE_LEN);
+
+    rcu_init();
+    rcu_sl_init(&sl);
+    for (i = 0; i < KEY_RANGE; i += 2) {
+        t = test_new(i);
+        rcu_sl_insert(&sl, &t->sl);
+    }
+    rcu_worker_start();
+
+    during = test_run(reader_side, READER_NUM, updater_side, UPDATER_NUM);
+
+    rcu_worker_stop();
+
+    printf("%.0f scans/sec, %.1f nodes/scan, %.0f updates/sec, %lu keys, "
+           "%lu rebuilds\n",
+           nr_scan / during, nr_scan ? (double)nr_visit / nr_scan : 0,
+           (double)UPDATER_NUM * UPDATE_NUM / during, sl.nr, sl.nr_rebuild);
+
+    rcu_sl_destroy(&sl, free_sl);
+    rcu_clean();
+
+    return test_report();
+}
@@ -0,0 +1,179 @@
+/*
+ * Registry benchmark: The reader registry of thrd-based RCU
+ *
+ * Register 1 to READER_MAX idle readers, measure the cost of registering a
+ * thread and the grace period sweeping over all the reader slots. Then the
+ * short-lived readers come and go without unregistering by themselves, the
+ * slots should be reused, and the offline readers should not slow down the
+ * grace period.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "thrd_rcu.h"
+
+#ifndef READER_MAX
+#define READER_MAX 256
+#endif
+
+#ifndef GP_NUM
+#define GP_NUM 1000
+#endif
+
+#ifndef CHURN_NUM
+#define CHURN_NUM 1000
+#endif
+
+static pthread_barrier_t registered;
+static pthread_barrier_t finished;
+static unsigned long register_ns;
+
+static __inline__ unsigned long time_ns(struct timespec *start,
+                                        struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000000UL + end->tv_nsec -
+           start->tv_nsec;
+}
+
+static void *reader_side(void *argv)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rcu_register_thread();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    __atomic_fetch_add(&register_ns, time_ns(&start, &end), __ATOMIC_RELAXED);
+
+    pthread_barrier_wait(&registered);
+    pthread_barrier_wait(&finished);
+
+    rcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+static __inline__ void benchmark(int nr_reader)
+{
+    pthread_t reader[READER_MAX];
+    struct timespec start, end;
+    int i;
+
+    register_ns = 0;
+    pthread_barrier_init(&registered, NULL, nr_reader + 1);
+    pthread_barrier_init(&finished, NULL, nr_reader + 1);
+
+    for (i = 0; i < nr_reader; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+    pthread_barrier_wait(&registered);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < GP_NUM; i++)
+        synchronize_rcu();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("reader %3d: register %6lu ns, grace period %8lu ns, slot %u\n",
+           nr_reader, register_ns / nr_reader,
+           time_ns(&start, &end) / GP_NUM, rcu_nr_slot());
+
+    pthread_barrier_wait(&finished);
+    for (i = 0; i < nr_reader; i++)
+        pthread_join(reader[i], NULL);
+
+    pthread_barrier_destroy(&registered);
+    pthread_barrier_destroy(&finished);
+}
+
+static void *churn_side(void *argv)
+{
+    rcu_register_thread();
+
+    rcu_read_lock();
+    rcu_read_unlock();
+
+    /* No rcu_unregister_thread(), the key destructor does it. */
+    pthread_exit(NULL);
+}
+
+static void *offline_side(void *argv)
+{
+    rcu_register_thread();
+    rcu_thread_offline();
+
+    pthread_barrier_wait(&registered);
+    pthread_barrier_wait(&finished);
+
+    rcu_thread_online();
+
+    pthread_exit(NULL);
+}
+
+static __inline__ void churn(void)
+{
+    pthread_t reader[READER_MAX];
+    struct timespec start, end;
+    int i;
+
+    for (i = 0; i < CHURN_NUM; i++) {
+        pthread_create(&reader[0], NULL, churn_side, NULL);
+        pthread_join(reader[0], NULL);
+    }
+    printf("churn %d readers: slot %u\n", CHURN_NUM, rcu_nr_slot());
+
+    pthread_barrier_init(&registered, NULL, READER_MAX + 1);
+    pthread_barrier_init(&finished, NULL, READER_MAX + 1);
+
+    for (i = 0; i < READER_MAX; i++)
+        pthread_create(&reader[i], NULL, offline_side, NULL);
+    pthread_barrier_wait(&registered);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < GP_NUM; i++)
+        synchronize_rcu();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("offline %d readers: grace period %8lu ns\n", READER_MAX,
+           time_ns(&start, &end) / GP_NUM);
+
+    pthread_barrier_wait(&finished);
+    for (i = 0; i < READER_MAX; i++)
+        pthread_join(reader[i], NULL);
+
+    pthread_barrier_destroy(&registered);
+    pthread_barrier_destroy(&finished);
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    printf("thrd rcu registry: reader 1 - %d, grace period %d\n", READER_MAX,
+           GP_NUM);
+
+    /* The slots are reused by the next round, so keep them until the end. */
+    for (i = 1; i <= READER_MAX; i *= 2)
+        benchmark(i);
+    churn();
+
+    rcu_clean();
+
+    return 0;
+}
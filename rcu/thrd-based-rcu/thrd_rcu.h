@@ -2,8 +2,9 @@
  * thread based RCU: Partitioning reference count to per thread storage
  *
  * Provide the multiple-updater for the rcu_assign_pointer by atomic_exchange
- * Even the reference count named by rcu_nesting, it doesn't support nesting
- * locking.
+ * The read-side critical section can be nested. The nesting depth is kept
+ * in thread-local storage and only the outermost lock and unlock touch the
+ * rcu_nesting which synchronize_rcu() reads.
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -27,6 +28,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include "../api.h"
 
@@ -47,17 +49,56 @@
 /* Avoid false sharing */
 #define __rcu_aligned __attribute__((aligned(128)))
 
+/* The sleep time of the idle callback worker, in microseconds. */
+#ifndef RCU_WORKER_DELAY
+#define RCU_WORKER_DELAY 100
+#endif
+
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+/* The reader slots are the array of chunks, each slot has its own cache
+ * line. The chunk is installed when the high-water mark first reaches it
+ * and never moves, so the grace period sweeps [0, hwm) linearly.
+ * Each chunk has one word of the online bitmap, the grace period only
+ * looks at the slots of the online threads.
+ */
+#define RCU_CHUNK_NR (sizeof(unsigned long) * 8)
+#ifndef RCU_MAX_CHUNK
+#define RCU_MAX_CHUNK 64
+#endif
+
 struct rcu_node {
-    unsigned int tid;
     int rcu_nesting[2];
-    struct rcu_node *next;
+    struct rcu_head *cbs;
+    /* The callbacks queued by the owner, taken and invoked by the worker.
+     * rcu_barrier() waits for cb_done to catch up with cb_queued.
+     */
+    unsigned long cb_queued;
+    unsigned long cb_taken;
+    unsigned long cb_done;
+    unsigned int next_free;
 } __rcu_aligned;
 
+struct rcu_chunk {
+    struct rcu_node node[RCU_CHUNK_NR];
+};
+
 struct rcu_data {
-    unsigned int nr_thread;
-    struct rcu_node *head;
+    struct rcu_chunk *chunk[RCU_MAX_CHUNK];
+    unsigned long online[RCU_MAX_CHUNK];
+    unsigned int hwm;
+    /* The free slots stack, ABA tag (high 32 bits) with slot + 1 */
+    unsigned long long free;
     unsigned int rcu_thrd_nesting_idx;
+    int membarrier;
+    unsigned long gp_seq;
     spinlock_t sp;
+    pthread_t worker;
+    int worker_run;
+    int worker_stop;
 };
 
 /* Easy to use */
@@ -66,122 +107,490 @@ struct rcu_data {
     ptr->rcu_nesting[READ_ONCE(__rcu_thrd_idx) & 0x01]
 #define rcu_thrd_nesting __rcu_thrd_nesting(__rcu_per_thrd_ptr)
 
-static struct rcu_data rcu_data = { .nr_thread = 0,
-                                    .head = NULL,
+static struct rcu_data rcu_data = { .chunk = { NULL },
+                                    .online = { 0 },
+                                    .hwm = 0,
+                                    .free = 0,
                                     .rcu_thrd_nesting_idx = 0,
-                                    .sp = SPINLOCK_INIT };
+                                    .membarrier = 0,
+                                    .gp_seq = 0,
+                                    .sp = SPINLOCK_INIT,
+                                    .worker_run = 0,
+                                    .worker_stop = 0 };
 static __thread struct rcu_node *__rcu_per_thrd_ptr;
+/* The grace period can flip the index while the reader is in the critical
+ * section, so unlock has to clear the slot which lock has set.
+ */
+static __thread int *__rcu_per_thrd_slot;
+static __thread unsigned int __rcu_per_thrd_depth;
+
+static __thread unsigned int __rcu_per_thrd_id;
 
-static __inline__ struct rcu_node *__rcu_node_add(unsigned int tid)
+/* The slot is given back by the key destructor when the thread exits. */
+static pthread_key_t __rcu_thrd_key;
+static pthread_once_t __rcu_thrd_key_once = PTHREAD_ONCE_INIT;
+
+static __inline__ struct rcu_node *__rcu_node_of(unsigned int id)
 {
-    struct rcu_node **indirect = &rcu_data.head;
-    struct rcu_node *node;
+    struct rcu_chunk *chunk;
+
+    chunk = __atomic_load_n(&rcu_data.chunk[id / RCU_CHUNK_NR],
+                            __ATOMIC_ACQUIRE);
+    return chunk ? &chunk->node[id % RCU_CHUNK_NR] : NULL;
+}
+
+static __inline__ unsigned int rcu_nr_slot(void)
+{
+    return __atomic_load_n(&rcu_data.hwm, __ATOMIC_ACQUIRE);
+}
+
+static __inline__ struct rcu_node *__rcu_chunk_install(unsigned int id)
+{
+    struct rcu_chunk **pos = &rcu_data.chunk[id / RCU_CHUNK_NR];
+    struct rcu_chunk *chunk, *old = NULL;
+
+    if (__atomic_load_n(pos, __ATOMIC_ACQUIRE))
+        return __rcu_node_of(id);
 
-    node = (struct rcu_node *)malloc(sizeof(struct rcu_node));
-    if (!node) {
-        fprintf(stderr, "__rcu_node_add: malloc failed\n");
+    chunk = (struct rcu_chunk *)aligned_alloc(128, sizeof(struct rcu_chunk));
+    if (!chunk) {
+        fprintf(stderr, "__rcu_chunk_install: aligned_alloc failed\n");
         abort();
     }
+    memset(chunk, 0, sizeof(struct rcu_chunk));
 
-    node->tid = tid;
-    node->rcu_nesting[0] = 0;
-    node->rcu_nesting[1] = 0;
-    node->next = NULL;
+    if (!__atomic_compare_exchange_n(pos, &old, chunk, 0, __ATOMIC_RELEASE,
+                                     __ATOMIC_ACQUIRE))
+        free(chunk);
 
-    spin_lock(&rcu_data.sp);
+    return __rcu_node_of(id);
+}
 
-    while (*indirect) {
-        if ((*indirect)->tid == node->tid) {
-            spin_unlock(&rcu_data.sp);
-            free(node);
-            return NULL;
-        }
-        indirect = &(*indirect)->next;
+static __inline__ int __rcu_slot_pop(void)
+{
+    unsigned long long head, new;
+    unsigned int id;
+
+    head = __atomic_load_n(&rcu_data.free, __ATOMIC_ACQUIRE);
+    do {
+        id = (unsigned int)head;
+        if (id == 0)
+            return -1;
+        new = ((head >> 32) + 1) << 32 |
+              READ_ONCE(__rcu_node_of(id - 1)->next_free);
+    } while (!__atomic_compare_exchange_n(&rcu_data.free, &head, new, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return id - 1;
+}
+
+static __inline__ void __rcu_slot_push(unsigned int id)
+{
+    struct rcu_node *node = __rcu_node_of(id);
+    unsigned long long head, new;
+
+    head = __atomic_load_n(&rcu_data.free, __ATOMIC_RELAXED);
+    do {
+        WRITE_ONCE(node->next_free, (unsigned int)head);
+        new = ((head >> 32) + 1) << 32 | (id + 1);
+    } while (!__atomic_compare_exchange_n(&rcu_data.free, &head, new, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Quiescent state for a long time, e.g. blocking on I/O. The grace period
+ * skips the offline thread entirely, it must not be in the read-side
+ * critical section until rcu_thread_online().
+ */
+static __inline__ void rcu_thread_offline(void)
+{
+    unsigned int id = __rcu_per_thrd_id;
+
+    __atomic_fetch_and(&rcu_data.online[id / RCU_CHUNK_NR],
+                       ~(1UL << (id % RCU_CHUNK_NR)), __ATOMIC_RELEASE);
+}
+
+static __inline__ void rcu_thread_online(void)
+{
+    unsigned int id = __rcu_per_thrd_id;
+
+    __atomic_fetch_or(&rcu_data.online[id / RCU_CHUNK_NR],
+                      1UL << (id % RCU_CHUNK_NR), __ATOMIC_SEQ_CST);
+    smp_mb();
+}
+
+static __inline__ void __rcu_slot_release(unsigned int id)
+{
+    __atomic_fetch_and(&rcu_data.online[id / RCU_CHUNK_NR],
+                       ~(1UL << (id % RCU_CHUNK_NR)), __ATOMIC_RELEASE);
+    __rcu_slot_push(id);
+}
+
+static void __rcu_thrd_key_destructor(void *value)
+{
+    __rcu_slot_release((unsigned int)((unsigned long)value - 1));
+    __rcu_per_thrd_ptr = NULL;
+}
+
+static void __rcu_thrd_key_init(void)
+{
+    if (pthread_key_create(&__rcu_thrd_key, __rcu_thrd_key_destructor)) {
+        fprintf(stderr, "__rcu_thrd_key_init: pthread_key_create failed\n");
+        abort();
     }
+}
+
+/* Take a free slot or a new one beyond the high-water mark, no lock and no
+ * walk over the other readers. The slot is released automatically when the
+ * thread exits.
+ */
+static __inline__ int rcu_register_thread(void)
+{
+    int id;
 
-    *indirect = node;
-    rcu_data.nr_thread++;
+    if (__rcu_per_thrd_ptr)
+        return 0;
 
-    spin_unlock(&rcu_data.sp);
+    pthread_once(&__rcu_thrd_key_once, __rcu_thrd_key_init);
 
-    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    id = __rcu_slot_pop();
+    if (id < 0) {
+        id = __atomic_fetch_add(&rcu_data.hwm, 1, __ATOMIC_ACQ_REL);
+        if (id >= RCU_CHUNK_NR * RCU_MAX_CHUNK) {
+            __atomic_fetch_sub(&rcu_data.hwm, 1, __ATOMIC_ACQ_REL);
+            return -ENOMEM;
+        }
+        __rcu_chunk_install(id);
+    }
 
-    return node;
+    __rcu_per_thrd_id = id;
+    __rcu_per_thrd_ptr = __rcu_node_of(id);
+    pthread_setspecific(__rcu_thrd_key, (void *)((unsigned long)id + 1));
+    rcu_thread_online();
+
+    return 0;
 }
 
-static __inline__ int rcu_init(void)
+/* Give the slot back, it must be outside the read-side critical section.
+ * The queued callbacks stay in the slot and are still taken by the worker.
+ */
+static __inline__ void rcu_unregister_thread(void)
 {
-    unsigned int tid = current_tid();
+    if (!__rcu_per_thrd_ptr)
+        return;
 
-    __rcu_per_thrd_ptr = __rcu_node_add(tid);
+    pthread_setspecific(__rcu_thrd_key, NULL);
+    __rcu_slot_release(__rcu_per_thrd_id);
+    __rcu_per_thrd_ptr = NULL;
+}
 
-    return (__rcu_per_thrd_ptr == NULL) ? -ENOMEM : 0;
+static __inline__ int rcu_init(void)
+{
+    return rcu_register_thread();
 }
 
+/* Free all the slots, the readers should have finished. */
 static __inline__ void rcu_clean(void)
 {
-    struct rcu_node *node, *tmp;
+    unsigned int i;
 
     spin_lock(&rcu_data.sp);
 
-    for (node = rcu_data.head; node != NULL; node = tmp) {
-        tmp = node->next;
-        if (__rcu_thrd_nesting(node) & 0x1)
-            usleep(10);
-        free(node);
+    for (i = 0; i < RCU_MAX_CHUNK; i++) {
+        free(rcu_data.chunk[i]);
+        rcu_data.chunk[i] = NULL;
+        rcu_data.online[i] = 0;
     }
 
-    rcu_data.head = NULL;
-    rcu_data.nr_thread = 0;
+    rcu_data.hwm = 0;
+    rcu_data.free = 0;
 
     spin_unlock(&rcu_data.sp);
 }
 
+/* Opt-in asymmetric fence. synchronize_rcu() issues the membarrier, so
+ * the readers only need the compiler barrier. Call it before the readers
+ * start; it returns -1 and keeps the full fence if it is not supported.
+ */
+static __inline__ int rcu_membarrier_init(void)
+{
+    if (membarrier_register())
+        return -1;
+    WRITE_ONCE(rcu_data.membarrier, 1);
+    return 0;
+}
+
+/* The store to rcu_thrd_nesting must be visible before the reader loads
+ * the protected pointer, otherwise synchronize_rcu() can miss the reader.
+ */
+#define rcu_read_fence()                    \
+    do {                                    \
+        if (READ_ONCE(rcu_data.membarrier)) \
+            barrier();                      \
+        else                                \
+            smp_mb();                       \
+    } while (0)
+
+/* The tests can preempt the reader between picking the slot and setting
+ * it, the window the grace period has to cover.
+ */
+#ifndef rcu_read_lock_pick_hook
+#define rcu_read_lock_pick_hook() \
+    do {                          \
+    } while (0)
+#endif
+
 /* The per-thread reference count will only modified by their owner
  * thread but will read by other threads. So here we use WRITE_ONCE().
+ * The inner lock and unlock only change the thread-local depth, no other
+ * thread reads it.
  */
 static __inline__ void rcu_read_lock(void)
 {
-    WRITE_ONCE(rcu_thrd_nesting, 1);
+    if (__rcu_per_thrd_depth++) {
+        barrier();
+        return;
+    }
+    __rcu_per_thrd_slot = &rcu_thrd_nesting;
+    rcu_read_lock_pick_hook();
+    WRITE_ONCE(*__rcu_per_thrd_slot, 1);
     //__atomic_store_n(&rcu_thrd_nesting, 1, __ATOMIC_RELAXED);
+    rcu_read_fence();
 }
 
 static __inline__ void rcu_read_unlock(void)
 {
-    WRITE_ONCE(rcu_thrd_nesting, 0);
+    barrier();
+    if (--__rcu_per_thrd_depth)
+        return;
+    WRITE_ONCE(*__rcu_per_thrd_slot, 0);
     //__atomic_store_n(&rcu_thrd_nesting, 0, __ATOMIC_RELAXED);
 }
 
-static __inline__ void synchronize_rcu(void)
+/* The grace-period sequence number, the LSB set 1 means the grace period
+ * is in progress. Each grace period adds two to it.
+ */
+#define rcu_seq_snap(seq) (((seq) + 3) & ~0x1UL)
+#define rcu_seq_done(seq, snap) ((long)((seq) - (snap)) >= 0)
+
+/* The number of the completed grace periods */
+static __inline__ unsigned long rcu_nr_gp(void)
+{
+    return __atomic_load_n(&rcu_data.gp_seq, __ATOMIC_ACQUIRE) >> 1;
+}
+
+/* Wait for the readers which have set the slot idx. When the
+ * rcu_thrd_nesting is odd, which means that the LSB set 1, that thread is
+ * in the read-side critical section.
+ */
+static __inline__ void __rcu_wait_readers(unsigned int idx)
 {
     struct rcu_node *node;
+    unsigned long online;
+    unsigned int i, nr_chunk;
+
+    nr_chunk = (rcu_nr_slot() + RCU_CHUNK_NR - 1) / RCU_CHUNK_NR;
+    for (i = 0; i < nr_chunk; i++) {
+        online = __atomic_load_n(&rcu_data.online[i], __ATOMIC_ACQUIRE);
+        for (; online; online &= online - 1) {
+            node = __rcu_node_of(i * RCU_CHUNK_NR + __builtin_ctzl(online));
+            while (READ_ONCE(node->rcu_nesting[idx]) & 0x1) {
+                //while (__atomic_load_n(&__rcu_thrd_nesting(node),
+                //                       __ATOMIC_RELAXED) &
+                //       0x1) {
+                //usleep(10);
+                barrier();
+            }
+        }
+    }
+}
+
+static __inline__ void synchronize_rcu(void)
+{
+    unsigned long snap;
+    unsigned int idx, phase;
 
+    /* A full grace period starting after the snapshot is enough for us, so
+     * the callers waiting on rcu_data.sp for the same grace period only
+     * need one of them to do it.
+     */
     __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    snap = rcu_seq_snap(__atomic_load_n(&rcu_data.gp_seq, __ATOMIC_ACQUIRE));
 
     spin_lock(&rcu_data.sp);
 
-    /* When the rcu_thrd_nesting is odd, which means that the LSB set 1,
-     * that thread is in the read-side critical section. Also, we need
-     * to skip the read side when it is in the new grace period.
+    if (rcu_seq_done(READ_ONCE(rcu_data.gp_seq), snap)) {
+        spin_unlock(&rcu_data.sp);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        return;
+    }
+
+    __atomic_store_n(&rcu_data.gp_seq, rcu_data.gp_seq + 1, __ATOMIC_RELAXED);
+
+    /* The fence of the grace period has to be after the start, it covers
+     * the updates of the callers sharing this grace period.
      */
-    for (node = rcu_data.head; node != NULL; node = node->next) {
-        while (READ_ONCE(__rcu_thrd_nesting(node)) & 0x1) {
-            //while (__atomic_load_n(&__rcu_thrd_nesting(node),
-            //                       __ATOMIC_RELAXED) &
-            //       0x1) {
-            //usleep(10);
-            barrier();
-        }
+    if (READ_ONCE(rcu_data.membarrier))
+        membarrier();
+    else
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* The reader picks the slot by the index and then sets it, so it may
+     * set the slot of the old index after a flip, and even after the scan
+     * of that flip has passed it. One flip is not enough: the next grace
+     * period would wait on the other slot only and miss the reader.
+     *
+     * So flip twice and wait on the old slot after each flip. Whichever
+     * slot the reader has set, one of the two scans waits for it. Each
+     * scan waits on the slot the new readers no longer pick, so the
+     * readers cannot starve the updater.
+     */
+    for (phase = 0; phase < 2; phase++) {
+        idx = __atomic_fetch_add(&__rcu_thrd_idx, 1, __ATOMIC_SEQ_CST) & 0x01;
+        __rcu_wait_readers(idx);
     }
 
-    /* Going to next grace period */
-    __atomic_fetch_add(&__rcu_thrd_idx, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&rcu_data.gp_seq, rcu_data.gp_seq + 1, __ATOMIC_RELEASE);
 
     spin_unlock(&rcu_data.sp);
 
     __atomic_thread_fence(__ATOMIC_SEQ_CST);
 }
 
+/* call_rcu() pushes the callback to the per-thread queue, the worker takes
+ * all the queues at once and invokes them after one grace period. Without
+ * the worker, it waits for the grace period and invokes the callback by
+ * itself.
+ */
+static __inline__ void call_rcu(struct rcu_head *head,
+                                void (*func)(struct rcu_head *head))
+{
+    struct rcu_node *node;
+
+    head->func = func;
+
+    if (!READ_ONCE(rcu_data.worker_run) ||
+        (!__rcu_per_thrd_ptr && rcu_init())) {
+        synchronize_rcu();
+        func(head);
+        return;
+    }
+
+    node = __rcu_per_thrd_ptr;
+    __atomic_store_n(&node->cb_queued, node->cb_queued + 1, __ATOMIC_RELAXED);
+    head->next = __atomic_load_n(&node->cbs, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&node->cbs, &head->next, head, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+/* The tests can preempt the worker between the queues of the sweep. */
+#ifndef rcu_worker_sweep_hook
+#define rcu_worker_sweep_hook() \
+    do {                        \
+    } while (0)
+#endif
+
+static __inline__ void *__rcu_worker(void *argv)
+{
+    struct rcu_head *list, *head, *next;
+    struct rcu_node *node;
+    unsigned int i;
+    int stop;
+
+    for (;;) {
+        /* Read the stop before taking the queues, so the callbacks queued
+         * before rcu_worker_stop() are always taken.
+         */
+        stop = __atomic_load_n(&rcu_data.worker_stop, __ATOMIC_ACQUIRE);
+
+        list = NULL;
+        for (i = 0; i < rcu_nr_slot(); i++) {
+            node = __rcu_node_of(i);
+            if (!node)
+                continue;
+            rcu_worker_sweep_hook();
+            head = __atomic_exchange_n(&node->cbs, NULL, __ATOMIC_ACQUIRE);
+            for (; head; head = next) {
+                next = head->next;
+                head->next = list;
+                list = head;
+                node->cb_taken++;
+            }
+        }
+
+        if (!list) {
+            if (stop)
+                break;
+            usleep(RCU_WORKER_DELAY);
+            continue;
+        }
+
+        /* One grace period for the whole batch */
+        synchronize_rcu();
+
+        for (; list; list = next) {
+            next = list->next;
+            list->func(list);
+        }
+
+        /* The queue of each thread is taken in order, so every callback
+         * taken so far has been invoked.
+         */
+        for (i = 0; i < rcu_nr_slot(); i++) {
+            node = __rcu_node_of(i);
+            if (node && node->cb_done != node->cb_taken)
+                __atomic_store_n(&node->cb_done, node->cb_taken,
+                                 __ATOMIC_RELEASE);
+        }
+    }
+
+    return NULL;
+}
+
+/* Start the callback worker before the updaters use call_rcu(). */
+static __inline__ int rcu_worker_start(void)
+{
+    if (READ_ONCE(rcu_data.worker_run))
+        return 0;
+
+    WRITE_ONCE(rcu_data.worker_stop, 0);
+    if (pthread_create(&rcu_data.worker, NULL, __rcu_worker, NULL))
+        return -EAGAIN;
+    WRITE_ONCE(rcu_data.worker_run, 1);
+
+    return 0;
+}
+
+/* Wait for the callbacks queued before by this thread have been invoked.
+ * Only the owner queues to the slot, so the callbacks of the others never
+ * count for us.
+ */
+static __inline__ void rcu_barrier(void)
+{
+    struct rcu_node *node = __rcu_per_thrd_ptr;
+    unsigned long nr;
+
+    if (!node)
+        return;
+
+    nr = node->cb_queued;
+    while ((long)(__atomic_load_n(&node->cb_done, __ATOMIC_ACQUIRE) - nr) < 0)
+        usleep(RCU_WORKER_DELAY);
+}
+
+/* Invoke the remaining callbacks and stop the worker. It should be called
+ * after the updaters have finished and before rcu_clean().
+ */
+static __inline__ void rcu_worker_stop(void)
+{
+    if (!READ_ONCE(rcu_data.worker_run))
+        return;
+
+    __atomic_store_n(&rcu_data.worker_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(rcu_data.worker, NULL);
+    WRITE_ONCE(rcu_data.worker_run, 0);
+}
+
 #define rcu_dereference(p)                                                \
     ({                                                                    \
         __typeof__(*p) *__r_d_p = (__typeof__(*p) __force *)READ_ONCE(p); \
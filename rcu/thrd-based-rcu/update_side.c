@@ -21,6 +21,8 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
 #include <pthread.h>
 
 #include "thrd_rcu.h"
@@ -28,25 +30,46 @@
 
 struct test {
     int count;
+    struct rcu_head rcu;
 };
 
+/* The trace time measures TRACE_LOOP updates of each updater. */
+#ifdef CONFIG_TRACE_TIME
+#define NR_UPDATE TRACE_LOOP
+#else
+#define NR_UPDATE UPDATE_NUM
+#endif
+
 static struct test __rcu *foo;
+static int stop;
 
+/* Keep reading until the updaters finish, so every grace period has the
+ * readers to wait.
+ */
 static void *reader_side(void *argv)
 {
     struct test __allow_unused *tmp;
 
     rcu_init();
 
-    rcu_read_lock();
+    while (!READ_ONCE(stop)) {
+        rcu_read_lock();
 
-    tmp = rcu_dereference(foo);
+        tmp = rcu_dereference(foo);
 
-    rcu_read_unlock();
+        rcu_read_unlock();
+    }
 
     pthread_exit(NULL);
 }
 
+#ifdef CONFIG_CALL_RCU
+static void free_rcu(struct rcu_head *head)
+{
+    free((char *)head - offsetof(struct test, rcu));
+}
+#endif
+
 static __inline__ void update_rcu(void)
 {
     struct test *newval = (struct test *)malloc(sizeof(struct test));
@@ -56,39 +79,77 @@ static __inline__ void update_rcu(void)
 
     oldp = rcu_assign_pointer(foo, newval);
 
+#ifdef CONFIG_CALL_RCU
+    call_rcu(&oldp->rcu, free_rcu);
+#else
     synchronize_rcu();
     free(oldp);
+#endif
 }
 
 static void *updater_side(void *argv)
 {
+#ifdef CONFIG_TRACE_TIME
     time_check_loop(update_rcu(), TRACE_LOOP);
+#else
+    int i;
+
+    for (i = 0; i < UPDATE_NUM; i++)
+        update_rcu();
+#endif
 
     pthread_exit(NULL);
 }
 
-static __inline__ void benchmark(void)
+/* Sweep the number of updaters from 1 to UPDATER_NUM, the updaters share
+ * the grace periods so the grace periods grow slower than the updates.
+ */
+static __inline__ void benchmark(int nr_updater)
 {
     pthread_t reader[READER_NUM];
     pthread_t updater[UPDATER_NUM];
+    struct timespec start, end;
+    unsigned long nr_gp;
+    double during;
     int i;
+
+    WRITE_ONCE(stop, 0);
+    nr_gp = rcu_nr_gp();
     foo = (struct test __rcu *)malloc(sizeof(struct test));
     rcu_uncheck(foo)->count = 0;
 
+#ifdef CONFIG_CALL_RCU
+    rcu_worker_start();
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     for (i = 0; i < READER_NUM / 2; i++)
         pthread_create(&reader[i], NULL, reader_side, NULL);
 
-    for (i = 0; i < UPDATER_NUM; i++)
+    for (i = 0; i < nr_updater; i++)
         pthread_create(&updater[i], NULL, updater_side, NULL);
 
     for (i = READER_NUM / 2; i < READER_NUM; i++)
         pthread_create(&reader[i], NULL, reader_side, NULL);
 
+    for (i = 0; i < nr_updater; i++)
+        pthread_join(updater[i], NULL);
+
+    /* The updates are done once the callbacks have freed the old data. */
+#ifdef CONFIG_CALL_RCU
+    rcu_worker_stop();
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    WRITE_ONCE(stop, 1);
     for (i = 0; i < READER_NUM; i++)
         pthread_join(reader[i], NULL);
 
-    for (i = 0; i < UPDATER_NUM; i++)
-        pthread_join(updater[i], NULL);
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    nr_gp = rcu_nr_gp() - nr_gp;
+    printf("updater %d: %.0f updates/sec, %lu grace periods for %d updates\n",
+           nr_updater, (double)nr_updater * NR_UPDATE / during, nr_gp,
+           nr_updater * NR_UPDATE);
 
     free(rcu_uncheck(foo));
 
@@ -97,8 +158,17 @@ static __inline__ void benchmark(void)
 
 int main(int argc, char *argv[])
 {
-    printf("thrd rcu update side: reader %d, updater %d\n", READER_NUM,
-           UPDATER_NUM);
-    benchmark();
+    const char *mode = "synchronize_rcu";
+    int i;
+
+#ifdef CONFIG_CALL_RCU
+    mode = "call_rcu";
+#endif
+
+    printf("thrd rcu update side: reader %d, updater %d, %s\n", READER_NUM,
+           UPDATER_NUM, mode);
+    for (i = 1; i < UPDATER_NUM; i *= 2)
+        benchmark(i);
+    benchmark(UPDATER_NUM);
     return 0;
 }
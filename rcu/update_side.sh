@@ -1,7 +1,28 @@
 #!/usr/bin/env bash
 
 make -C locked-rcu update
-make -C thrd-based-rcu update
+make -C thrd-based-rcu update UPDATER_NUM=8
 ./locked-rcu/test
 echo "-------------------------"
 ./thrd-based-rcu/test
+echo "-------------------------"
+make -C locked-rcu update CONFIG_DEFER=y
+./locked-rcu/test
+echo "-------------------------"
+make -C thrd-based-rcu update UPDATER_NUM=8 CONFIG_CALL_RCU=y
+./thrd-based-rcu/test
+echo "-------------------------"
+make -C qsbr-rcu update
+./qsbr-rcu/test
+echo "-------------------------"
+make -C ebr update
+./ebr/test
+echo "-------------------------"
+make -C user-lrcu update
+./user-lrcu/test
+echo "-------------------------"
+make -C user-lrcu update CONFIG_MEMBARRIER=y
+./user-lrcu/test
+echo "-------------------------"
+make -C user-lrcu update UPDATER_NUM=8 CONFIG_CALL_LRCU=y
+./user-lrcu/test
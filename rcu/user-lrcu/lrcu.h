@@ -0,0 +1,522 @@
+/*
+ * Little Read Copy Update: The userspace port of the Classic RCU
+ *
+ * The kernel version disables the preemption in the read-side critical
+ * section, so the updater running on every online CPU once means that all
+ * the readers have finished. The userspace readers can be preempted at any
+ * time, so each of them announces the grace-period counter it has seen in
+ * its own node instead. Hopping on every CPU still forces the context
+ * switch, which is the full fence, on every CPU. So the readers only need
+ * the compiler barrier, the same as the membarrier(2) does.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#ifndef __LRCU_H__
+#define __LRCU_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../api.h"
+#include "../trace_timer.h"
+
+#ifdef __CHECKER__
+#define __lrcu __attribute__((noderef, address_space(__lrcu)))
+#define lrcu_check_sparse(p, space) ((void)(((typeof(*p) space *)p) == p))
+#define __force __attribute__((force))
+#else
+#define __lrcu
+#define lrcu_check_sparse(p, space)
+#define __force
+#endif /* __CHECKER__ */
+
+/* Avoid false sharing */
+#define __lrcu_aligned __attribute__((aligned(128)))
+
+/* The initial size of the retired pointer list, it doubles until it
+ * reaches LRCU_LIST_MAX. lrcu_assign_pointer() fails when it is full.
+ */
+#ifndef LRCU_LIST_SIZE
+#define LRCU_LIST_SIZE 16
+#endif
+
+#ifndef LRCU_LIST_MAX
+#define LRCU_LIST_MAX 4096
+#endif
+
+/* The sleep time of the idle callback worker, in microseconds. */
+#ifndef LRCU_WORKER_DELAY
+#define LRCU_WORKER_DELAY 100
+#endif
+
+/* The grace-period counter is always odd, zero means not in the critical
+ * section.
+ */
+#define LRCU_GP_CTR 0x2UL
+
+typedef void (*lrcu_callback_t)(void *);
+
+/* call_lrcu() only counts the request, the worker serves all the requests
+ * pending with one grace period and passes the pointers retired before it
+ * to the callback.
+ */
+struct lrcu_data {
+    void __lrcu **list;
+    unsigned int nr;
+    unsigned int size;
+    spinlock_t list_lock;
+    /* Only the worker uses it, the callbacks run on it without the lock. */
+    void **batch;
+    unsigned int batch_size;
+    lrcu_callback_t callback;
+    pthread_t worker;
+    int worker_stop;
+    unsigned long nr_req;
+    unsigned long nr_done;
+    unsigned long nr_gp;
+    unsigned long nr_cb;
+    unsigned long gp_ns;
+};
+
+/* The readers, it replaces the preempt count of the kernel version. */
+struct lrcu_node {
+    unsigned long ctr;
+    struct lrcu_node *next;
+} __lrcu_aligned;
+
+struct lrcu_state {
+    unsigned long gp_ctr;
+    struct lrcu_node *head;
+    spinlock_t sp;
+};
+
+static struct lrcu_state lrcu_state = { .gp_ctr = 0x1UL,
+                                        .head = NULL,
+                                        .sp = SPINLOCK_INIT };
+static __thread struct lrcu_node *__lrcu_per_thrd_ptr;
+static __thread unsigned int __lrcu_per_thrd_depth;
+
+static void *__lrcu_worker(void *argv);
+
+static __inline__ struct lrcu_data *lrcu_data_init(lrcu_callback_t cb)
+{
+    struct lrcu_data *ldp = malloc(sizeof(struct lrcu_data));
+    if (!ldp)
+        return NULL;
+    ldp->list = malloc(sizeof(void *) * LRCU_LIST_SIZE);
+    if (!ldp->list) {
+        free(ldp);
+        return NULL;
+    }
+    ldp->nr = 0;
+    ldp->size = LRCU_LIST_SIZE;
+    spin_lock_init(&ldp->list_lock);
+    ldp->batch = NULL;
+    ldp->batch_size = 0;
+    ldp->callback = cb;
+    ldp->worker_stop = 0;
+    ldp->nr_req = 0;
+    ldp->nr_done = 0;
+    ldp->nr_gp = 0;
+    ldp->nr_cb = 0;
+    ldp->gp_ns = 0;
+
+    if (pthread_create(&ldp->worker, NULL, __lrcu_worker, (void *)ldp)) {
+        free(ldp->list);
+        free(ldp);
+        return NULL;
+    }
+
+    return ldp;
+}
+
+/* Hold the list_lock when it returns 0, lrcu_assign_pointer() unlocks. */
+static __inline__ int __lrcu_collect_old_pointer(struct lrcu_data *lrcu_data,
+                                                 void __lrcu **oldpp)
+{
+    void __lrcu **list;
+
+    spin_lock(&lrcu_data->list_lock);
+
+    if (lrcu_data->nr == lrcu_data->size) {
+        if (lrcu_data->size >= LRCU_LIST_MAX) {
+            spin_unlock(&lrcu_data->list_lock);
+            return -ENOSPC;
+        }
+        list = realloc(lrcu_data->list, sizeof(void *) * lrcu_data->size * 2);
+        if (!list) {
+            spin_unlock(&lrcu_data->list_lock);
+            fprintf(stderr, "lrcu_assign_pointer:"
+                            "__lrcu_collect_old_pointer - realloc failed\n");
+            return -ENOMEM;
+        }
+        lrcu_data->list = list;
+        lrcu_data->size *= 2;
+    }
+
+    lrcu_data->list[lrcu_data->nr++] = READ_ONCE(*oldpp);
+
+    return 0;
+}
+
+/* lrcu_assign_pointer() - assign to LRCU-protected pointer
+ *
+ * Return the old pointer, or NULL and leave it unchanged if the list is
+ * full. With call_lrcu(), lrcu_barrier() empties the list.
+ */
+#define lrcu_assign_pointer(oldp, newp, ldp)                                  \
+    ({                                                                        \
+        typeof(*(oldp)) *__l_r_rev = NULL;                                    \
+        lrcu_check_sparse(oldp, __lrcu);                                      \
+                                                                              \
+        if (!__lrcu_collect_old_pointer((ldp), (void __lrcu **)&(oldp))) {    \
+            __l_r_rev = (typeof(*(oldp)) __force *)(ldp)->list[(ldp)->nr - 1]; \
+            __atomic_store_n(&(oldp),                                         \
+                             (typeof(*(oldp)) __force __lrcu *)(newp),        \
+                             __ATOMIC_RELEASE);                               \
+            spin_unlock(&(ldp)->list_lock);                                   \
+        }                                                                     \
+        __l_r_rev;                                                            \
+    })
+
+/* lrcu_dereference() - dereference the LRCU-portected pointer
+ *
+ * This macro does not provide the lock checking.
+ */
+#define lrcu_dereference(p)                                      \
+    ({                                                           \
+        typeof(*p) *__l_r_p = (typeof(*p) __force *)READ_ONCE(p); \
+        lrcu_check_sparse(p, __lrcu);                            \
+        __l_r_p;                                                 \
+    })
+
+static __inline__ int lrcu_register_thread(void)
+{
+    struct lrcu_node *node;
+
+    if (__lrcu_per_thrd_ptr)
+        return 0;
+
+    node = (struct lrcu_node *)aligned_alloc(128, sizeof(struct lrcu_node));
+    if (!node)
+        return -ENOMEM;
+    node->ctr = 0;
+
+    spin_lock(&lrcu_state.sp);
+    node->next = lrcu_state.head;
+    lrcu_state.head = node;
+    spin_unlock(&lrcu_state.sp);
+
+    __lrcu_per_thrd_ptr = node;
+
+    return 0;
+}
+
+/* It must be outside the critical section. */
+static __inline__ void lrcu_unregister_thread(void)
+{
+    struct lrcu_node **indirect = &lrcu_state.head;
+
+    if (!__lrcu_per_thrd_ptr)
+        return;
+
+    spin_lock(&lrcu_state.sp);
+    while (*indirect != __lrcu_per_thrd_ptr)
+        indirect = &(*indirect)->next;
+    *indirect = __lrcu_per_thrd_ptr->next;
+    spin_unlock(&lrcu_state.sp);
+
+    free(__lrcu_per_thrd_ptr);
+    __lrcu_per_thrd_ptr = NULL;
+}
+
+/* The readers should have finished. */
+static __inline__ void lrcu_clean(void)
+{
+    struct lrcu_node *node, *tmp;
+
+    spin_lock(&lrcu_state.sp);
+
+    for (node = lrcu_state.head; node != NULL; node = tmp) {
+        tmp = node->next;
+        free(node);
+    }
+    lrcu_state.head = NULL;
+
+    spin_unlock(&lrcu_state.sp);
+}
+
+/* The per-thread counter will only modified by their owner thread but
+ * will read by the updater. No fence here, the updater forces it.
+ */
+static __inline__ void lrcu_read_lock(void)
+{
+    if (__lrcu_per_thrd_depth++) {
+        barrier();
+        return;
+    }
+
+    if (!__lrcu_per_thrd_ptr && lrcu_register_thread()) {
+        fprintf(stderr, "lrcu_read_lock: lrcu_register_thread failed\n");
+        abort();
+    }
+
+    WRITE_ONCE(__lrcu_per_thrd_ptr->ctr, READ_ONCE(lrcu_state.gp_ctr));
+    barrier();
+}
+
+static __inline__ void lrcu_read_unlock(void)
+{
+    barrier();
+    if (--__lrcu_per_thrd_depth)
+        return;
+    WRITE_ONCE(__lrcu_per_thrd_ptr->ctr, 0);
+}
+
+#ifdef CONFIG_MEMBARRIER
+
+/* return 0 if membarrier(2) can be used */
+static __inline__ int lrcu_sched_init(void)
+{
+    return membarrier_register();
+}
+
+#define lrcu_force_mb() membarrier()
+
+#else /* !CONFIG_MEMBARRIER */
+
+static __inline__ int lrcu_sched_init(void)
+{
+    cpu_set_t mask;
+
+    return sched_getaffinity(0, sizeof(mask), &mask) ? -1 : 0;
+}
+
+#define run_on(cpu)                                              \
+    ({                                                           \
+        cpu_set_t __r_o_mask;                                    \
+        CPU_ZERO(&__r_o_mask);                                   \
+        CPU_SET((cpu), &__r_o_mask);                             \
+        sched_setaffinity(0, sizeof(__r_o_mask), &__r_o_mask);   \
+    })
+
+/* Running on the CPU means the thread ran on it before has been switched
+ * out. Hop over the CPUs this thread is allowed to, then restore it.
+ */
+static __inline__ void lrcu_force_mb(void)
+{
+    cpu_set_t mask;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(mask), &mask)) {
+        fprintf(stderr, "lrcu_force_mb: sched_getaffinity failed\n");
+        abort();
+    }
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &mask))
+            run_on(cpu);
+    }
+
+    sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+#endif /* CONFIG_MEMBARRIER */
+
+static __inline__ void __lrcu_grace_period(void)
+{
+    struct lrcu_node *node;
+    unsigned long gp_ctr, ctr;
+
+    spin_lock(&lrcu_state.sp);
+
+    /* The readers either see the new pointer or are seen by the scan. */
+    lrcu_force_mb();
+
+    gp_ctr = READ_ONCE(lrcu_state.gp_ctr) + LRCU_GP_CTR;
+    WRITE_ONCE(lrcu_state.gp_ctr, gp_ctr);
+
+    /* Wait for the readers which entered before the new counter. */
+    for (node = lrcu_state.head; node != NULL; node = node->next) {
+        while ((ctr = READ_ONCE(node->ctr)) && ctr != gp_ctr)
+            barrier();
+    }
+
+    /* The reads of the finished readers are done before the free. */
+    lrcu_force_mb();
+
+    spin_unlock(&lrcu_state.sp);
+}
+
+/* Drop the first nr pointers of the list, it needs list_lock. The
+ * concurrent synchronize_lrcu() may have dropped some of them.
+ */
+static __inline__ void __lrcu_list_drop(struct lrcu_data *lrcu_data,
+                                        unsigned int nr)
+{
+    if (nr > lrcu_data->nr)
+        nr = lrcu_data->nr;
+    lrcu_data->nr -= nr;
+    memmove(lrcu_data->list, lrcu_data->list + nr,
+            sizeof(void *) * lrcu_data->nr);
+}
+
+/* The caller frees the pointer returned by lrcu_assign_pointer() itself,
+ * so do not mix it with call_lrcu() on the same lrcu_data.
+ */
+static __inline__ void synchronize_lrcu(struct lrcu_data *lrcu_data)
+{
+    unsigned int nr;
+
+    smp_mb();
+
+    /* Only the pointers retired before the grace period are safe after. */
+    spin_lock(&lrcu_data->list_lock);
+    nr = lrcu_data->nr;
+    spin_unlock(&lrcu_data->list_lock);
+
+    __lrcu_grace_period();
+
+    spin_lock(&lrcu_data->list_lock);
+    __lrcu_list_drop(lrcu_data, nr);
+    spin_unlock(&lrcu_data->list_lock);
+
+    smp_mb();
+}
+
+/* Serve the requests pending with one grace period, return 0 if there is
+ * no request.
+ */
+static __inline__ int __lrcu_do_batch(struct lrcu_data *lrcu_data)
+{
+    unsigned long req, gp_ns = 0;
+    unsigned int nr, i;
+    void **batch;
+
+    spin_lock(&lrcu_data->list_lock);
+    req = lrcu_data->nr_req;
+    nr = lrcu_data->nr;
+    spin_unlock(&lrcu_data->list_lock);
+
+    if (req == READ_ONCE(lrcu_data->nr_done))
+        return 0;
+
+    if (nr > lrcu_data->batch_size) {
+        batch = realloc(lrcu_data->batch, sizeof(void *) * nr);
+        if (!batch) {
+            fprintf(stderr, "__lrcu_worker:"
+                            "__lrcu_do_batch - realloc failed\n");
+            return -ENOMEM;
+        }
+        lrcu_data->batch = batch;
+        lrcu_data->batch_size = nr;
+    }
+
+    /* The grace period is only timed with CONFIG_TRACE_TIME. */
+#ifdef CONFIG_TRACE_TIME
+    gp_ns = time_check_return(__lrcu_grace_period());
+#else
+    __lrcu_grace_period();
+#endif
+
+    /* Detach the pointers under the lock, the callback may assign the
+     * pointer or call call_lrcu() on the same lrcu_data.
+     */
+    spin_lock(&lrcu_data->list_lock);
+    if (nr > lrcu_data->nr)
+        nr = lrcu_data->nr;
+    memcpy(lrcu_data->batch, lrcu_data->list, sizeof(void *) * nr);
+    __lrcu_list_drop(lrcu_data, nr);
+    lrcu_data->nr_gp++;
+    lrcu_data->nr_cb += nr;
+    lrcu_data->gp_ns += gp_ns;
+    spin_unlock(&lrcu_data->list_lock);
+
+    for (i = 0; i < nr; i++)
+        lrcu_data->callback((void __force *)lrcu_data->batch[i]);
+
+    __atomic_store_n(&lrcu_data->nr_done, req, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static void *__lrcu_worker(void *argv)
+{
+    struct lrcu_data *lrcu_data = (struct lrcu_data *)argv;
+    int stop, ret;
+
+    for (;;) {
+        /* Read the stop before the requests, so the requests before
+         * lrcu_data_free() are always served.
+         */
+        stop = __atomic_load_n(&lrcu_data->worker_stop, __ATOMIC_ACQUIRE);
+        ret = __lrcu_do_batch(lrcu_data);
+        if (ret > 0)
+            continue;
+        /* Retry the failed batch later even if it is stopping. */
+        if (!ret && stop)
+            break;
+        usleep(LRCU_WORKER_DELAY);
+    }
+
+    return NULL;
+}
+
+/* Pass the pointers retired so far to the callback after a grace period,
+ * it never blocks. The requests before the worker wakes up share one
+ * grace period.
+ */
+static __inline__ void call_lrcu(struct lrcu_data *lrcu_data)
+{
+    smp_mb();
+
+    spin_lock(&lrcu_data->list_lock);
+    lrcu_data->nr_req++;
+    spin_unlock(&lrcu_data->list_lock);
+}
+
+/* Wait for the requests before have been served. */
+static __inline__ void lrcu_barrier(struct lrcu_data *lrcu_data)
+{
+    unsigned long req = READ_ONCE(lrcu_data->nr_req);
+
+    while ((long)(__atomic_load_n(&lrcu_data->nr_done, __ATOMIC_ACQUIRE) -
+                  req) < 0)
+        usleep(LRCU_WORKER_DELAY);
+}
+
+/* Serve the remaining requests and stop the worker. The pointers not
+ * passed to call_lrcu() are left to the caller of synchronize_lrcu().
+ */
+static __inline__ void lrcu_data_free(struct lrcu_data *lrcu_data)
+{
+    __atomic_store_n(&lrcu_data->worker_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(lrcu_data->worker, NULL);
+
+    free(lrcu_data->batch);
+    free(lrcu_data->list);
+    free(lrcu_data);
+}
+
+#endif /* __LRCU_H__ */
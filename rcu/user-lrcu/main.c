@@ -0,0 +1,129 @@
+/*
+ * Read Copy Update: A benchmark of userspace Classic RCU
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "lrcu.h"
+
+struct test {
+    int count;
+};
+
+static struct test __lrcu *foo;
+static struct lrcu_data *ld;
+
+static void *reader_side(void *argv)
+{
+    struct test __allow_unused *tmp;
+
+    
+    lrcu_read_lock();
+
+    tmp = lrcu_dereference(foo);
+
+    //printf("[reader %d] %d\n", current_tid(), tmp->count);
+
+    lrcu_read_unlock();
+
+    lrcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+static void *updater_side(void *argv)
+{
+    struct test *oldp;
+    struct test *newval = (struct test *)malloc(sizeof(struct test));
+    newval->count = current_tid();
+
+    //printf("[updater %d]\n", newval->count);
+
+    oldp = lrcu_assign_pointer(foo, newval, ld);
+
+    synchronize_lrcu(ld);
+    free(oldp);
+
+    pthread_exit(NULL);
+}
+
+static __inline__ void benchmark(void)
+{
+    pthread_t reader[READER_NUM];
+    pthread_t updater[UPDATER_NUM];
+    int i;
+    foo = (struct test __lrcu *)malloc(sizeof(struct test));
+    // reset the foo->count
+    ((struct test __force *)foo)->count = 0;
+
+    for (i = 0; i < READER_NUM / 2; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+
+    for (i = 0; i < UPDATER_NUM; i++)
+        pthread_create(&updater[i], NULL, updater_side, NULL);
+
+    for (i = READER_NUM / 2; i < READER_NUM; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+
+    for (i = 0; i < READER_NUM; i++)
+        pthread_join(reader[i], NULL);
+
+    for (i = 0; i < UPDATER_NUM; i++)
+        pthread_join(updater[i], NULL);
+
+    free((struct test __force *)foo);
+
+    lrcu_clean();
+}
+
+#include "../trace_timer.h"
+
+static void lrcu_call_back(void *data)
+{
+    free(data);
+}
+
+static int lrcu_init(void)
+{
+    if (lrcu_sched_init()) {
+        fprintf(stderr, "lrcu_init: lrcu_sched_init failed\n");
+        return -1;
+    }
+
+    ld = lrcu_data_init(lrcu_call_back);
+    if (!ld) {
+        fprintf(stderr, "lrcu_init: lrcu_data_init failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (lrcu_init())
+        return -1;
+
+    time_check_loop(benchmark(), TRACE_LOOP);
+
+    lrcu_data_free(ld);
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Update side benchmark: A benchmark of userspace Classic RCU
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "lrcu.h"
+#include "../trace_timer.h"
+
+struct test {
+    int count;
+    struct timespec retire;
+};
+
+/* The trace time measures TRACE_LOOP updates of each updater. */
+#ifdef CONFIG_TRACE_TIME
+#define NR_UPDATE TRACE_LOOP
+#else
+#define NR_UPDATE UPDATE_NUM
+#endif
+
+static struct test __lrcu *foo;
+static struct lrcu_data *ld;
+static int stop;
+/* From lrcu_assign_pointer() to the free, updated by the worker only */
+static unsigned long retire_ns;
+
+/* Keep reading until the updaters finish, so every grace period has the
+ * readers to wait.
+ */
+static void *reader_side(void *argv)
+{
+    struct test __allow_unused *tmp;
+
+    while (!READ_ONCE(stop)) {
+        lrcu_read_lock();
+
+        tmp = lrcu_dereference(foo);
+
+        lrcu_read_unlock();
+    }
+
+    lrcu_unregister_thread();
+
+    pthread_exit(NULL);
+}
+
+static __inline__ void update_rcu(void)
+{
+    struct test *newval = (struct test *)malloc(sizeof(struct test));
+    newval->count = current_tid();
+
+    struct test *oldp;
+
+    /* The list is full, wait for the worker to empty it. */
+    while (!(oldp = lrcu_assign_pointer(foo, newval, ld)))
+        lrcu_barrier(ld);
+
+#ifdef CONFIG_CALL_LRCU
+    /* The readers never touch it. */
+    clock_gettime(CLOCK_MONOTONIC, &oldp->retire);
+    call_lrcu(ld);
+#else
+    synchronize_lrcu(ld);
+    free(oldp);
+#endif
+}
+
+static void *updater_side(void *argv)
+{
+#ifdef CONFIG_TRACE_TIME
+    time_check_loop(update_rcu(), TRACE_LOOP);
+#else
+    int i;
+
+    for (i = 0; i < UPDATE_NUM; i++)
+        update_rcu();
+#endif
+
+    pthread_exit(NULL);
+}
+
+/* Sweep the number of updaters from 1 to UPDATER_NUM, with call_lrcu()
+ * the requests share the grace periods.
+ */
+static __inline__ void benchmark(int nr_updater)
+{
+    pthread_t reader[READER_NUM];
+    pthread_t updater[UPDATER_NUM];
+    struct timespec start, end;
+    double during;
+    int i;
+#ifdef CONFIG_CALL_LRCU
+    unsigned long nr_gp = ld->nr_gp, nr_cb = ld->nr_cb, gp_ns = ld->gp_ns;
+
+    retire_ns = 0;
+#endif
+
+    WRITE_ONCE(stop, 0);
+    foo = (struct test __lrcu *)malloc(sizeof(struct test));
+    ((struct test __force *)foo)->count = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < READER_NUM / 2; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+
+    for (i = 0; i < nr_updater; i++)
+        pthread_create(&updater[i], NULL, updater_side, NULL);
+
+    for (i = READER_NUM / 2; i < READER_NUM; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+
+    for (i = 0; i < nr_updater; i++)
+        pthread_join(updater[i], NULL);
+
+    /* The updates are done once the callbacks have freed the old data. */
+    lrcu_barrier(ld);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    WRITE_ONCE(stop, 1);
+    for (i = 0; i < READER_NUM; i++)
+        pthread_join(reader[i], NULL);
+
+    during = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("updater %d: %.0f updates/sec", nr_updater,
+           (double)nr_updater * NR_UPDATE / during);
+#ifdef CONFIG_CALL_LRCU
+    nr_gp = ld->nr_gp - nr_gp;
+    nr_cb = ld->nr_cb - nr_cb;
+    gp_ns = ld->gp_ns - gp_ns;
+    printf(", %lu callbacks in %lu grace periods", nr_cb, nr_gp);
+#ifdef CONFIG_TRACE_TIME
+    printf(", grace period %lu ns", nr_gp ? gp_ns / nr_gp : 0);
+#endif
+    printf(", retire to free %lu ns", nr_cb ? retire_ns / nr_cb : 0);
+#endif
+    printf("\n");
+
+    free((struct test __force *)foo);
+
+    lrcu_clean();
+}
+
+static void lrcu_call_back(void *data)
+{
+    struct test *p = (struct test *)data;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    retire_ns += (now.tv_sec - p->retire.tv_sec) * 1000000000UL +
+                 now.tv_nsec - p->retire.tv_nsec;
+    free(p);
+}
+
+static int lrcu_init(void)
+{
+    if (lrcu_sched_init()) {
+        fprintf(stderr, "lrcu_init: lrcu_sched_init failed\n");
+        return -1;
+    }
+
+    ld = lrcu_data_init(lrcu_call_back);
+    if (!ld) {
+        fprintf(stderr, "lrcu_init: lrcu_data_init failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mode = "synchronize_lrcu";
+    int i;
+
+#ifdef CONFIG_CALL_LRCU
+    mode = "call_lrcu";
+#endif
+
+    if (lrcu_init())
+        return -1;
+
+    printf("lrcu update side: reader %d, updater %d, %s\n", READER_NUM,
+           UPDATER_NUM, mode);
+    for (i = 1; i < UPDATER_NUM; i *= 2)
+        benchmark(i);
+    benchmark(UPDATER_NUM);
+
+    lrcu_data_free(ld);
+    return 0;
+}
@@ -26,6 +26,9 @@
 #define __SEQLOCK_H__
 
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 typedef struct seqlock {
     atomic_int seqcount;
@@ -33,21 +36,31 @@ typedef struct seqlock {
 } seqlock_t;
 
 #define DEFINE_SEQLOCK(name)                         \
-    seqlock_t name = { .seqnum = ATOMIC_VAR_INIT(0), \
+    seqlock_t name = { .seqcount = ATOMIC_VAR_INIT(0), \
                        .__write_lock = ATOMIC_FLAG_INIT }
 
+static inline void seqlock_init(seqlock_t *lock)
+{
+    atomic_init(&lock->seqcount, 0);
+    atomic_flag_clear(&lock->__write_lock);
+}
+
+/* The stores of the data must not be visible before the seqcount becomes
+ * odd, the release fence orders the increment before them.
+ */
 static inline void write_seqlock(seqlock_t *lock)
 {
     while (atomic_flag_test_and_set_explicit(&lock->__write_lock,
-                                             memory_order_release))
+                                             memory_order_acquire))
         ;
-    atomic_fetch_add_explicit(&lock->seqcount, 1, memory_order_release);
+    atomic_fetch_add_explicit(&lock->seqcount, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 }
 
 static inline void write_sequnlock(seqlock_t *lock)
 {
     atomic_fetch_add_explicit(&lock->seqcount, 1, memory_order_release);
-    atomic_flag_clear(&lock->__write_lock, memory_order_release);
+    atomic_flag_clear_explicit(&lock->__write_lock, memory_order_release);
 }
 
 /* Following are the reader operation
@@ -62,14 +75,18 @@ static inline int read_seqbegin(seqlock_t *lock)
 {
     int seq;
     do {
-        seq = atomic_load_explicit(&lock->seqcount, memory_order_consume);
-    } while (!(seq & 0x1));
+        seq = atomic_load_explicit(&lock->seqcount, memory_order_acquire);
+    } while (seq & 0x1);
     return seq;
 }
 
+/* The acquire fence orders the loads of the data before the load of the
+ * seqcount, pairs with the release fence of write_seqlock().
+ */
 static inline bool read_seqretry(seqlock_t *lock, int seq)
 {
-    if (seq == atomic_load_explicit(&lock->seqcount, memory_order_acquire))
+    atomic_thread_fence(memory_order_acquire);
+    if (seq == atomic_load_explicit(&lock->seqcount, memory_order_relaxed))
         return false;
     return true;
 }
@@ -78,29 +95,29 @@ static inline bool read_seqretry(seqlock_t *lock, int seq)
 static inline void read_seqlock_excl(seqlock_t *lock)
 {
     while (atomic_flag_test_and_set_explicit(&lock->__write_lock,
-                                             memory_order_release))
+                                             memory_order_acquire))
         ;
 }
 
 static inline void read_sequnlock_excl(seqlock_t *lock)
 {
-    atomic_flag_clear(&lock->__write_lock, memory_order_release);
+    atomic_flag_clear_explicit(&lock->__write_lock, memory_order_release);
 }
 
 /* The optimistic read_seqbegin, when the seqcount is odd number few times,
  * it turn into locked reader.
  * When the read side use these operation, the -1 value will store into seq.
  */
-static inline void read_seqbegin_or_lock(seqlock_t *locki, int *seq)
+static inline void read_seqbegin_or_lock(seqlock_t *lock, int *seq)
 {
     int seqcnt, try_cnt = 0;
 
-     do {
+    do {
         if (try_cnt > 10)
             goto locked;
         try_cnt++;
-        seqcnt = atomic_load_explicit(&lock->seqcount, memory_order_consume);
-    } while (!(seqcnt & 0x1));
+        seqcnt = atomic_load_explicit(&lock->seqcount, memory_order_acquire);
+    } while (seqcnt & 0x1);
 
     *seq = seqcnt;
     return;
@@ -114,14 +131,110 @@ static inline bool need_seqretry(seqlock_t *lock, int seq)
     // read side is locking so the data is newest.
     if (seq == -1)
         return false;
-   return read_seqretry(lock, seq);
+    return read_seqretry(lock, seq);
 }
 
 static inline void done_seqretry(seqlock_t *lock, int seq)
 {
     if (seq != -1)
         return;
-    read_seqlock_excl(lock);
+    read_sequnlock_excl(lock);
+}
+
+/* The seqlock protected data, copied in and out by the word-sized atomic
+ * accesses, so the reader racing with the writer reads the torn data
+ * without the data race, and the retry throws it away.
+ *
+ *     static SEQLOCK_DATA(struct stats) sd;
+ *
+ *     seq_data_init(&sd);
+ *     seq_write(&sd, &new_stats);
+ *     seq_read_copy(&sd, &snapshot);
+ */
+#define SEQ_DATA_WORDS(type) \
+    ((sizeof(type) + sizeof(atomic_ulong) - 1) / sizeof(atomic_ulong))
+
+#define SEQLOCK_DATA(type)                       \
+    struct {                                     \
+        seqlock_t lock;                          \
+        atomic_ulong words[SEQ_DATA_WORDS(type)]; \
+    }
+
+#define seq_data_init(sd)                                         \
+    do {                                                          \
+        size_t __i;                                               \
+        seqlock_init(&(sd)->lock);                                \
+        for (__i = 0; __i < sizeof((sd)->words) / sizeof(atomic_ulong); \
+             __i++)                                               \
+            atomic_init(&(sd)->words[__i], 0);                    \
+    } while (0)
+
+/* The object copied must fit in the words. */
+#define __seq_data_check(sd, p)                                  \
+    _Static_assert(sizeof(*(p)) <= sizeof((sd)->words),          \
+                   "seqlock data: the object is larger than the data")
+
+/* Return the number of the retries. */
+#define seq_read_copy(sd, out)                                             \
+    __extension__({                                                        \
+        __seq_data_check(sd, out);                                         \
+        __seq_read_copy(&(sd)->lock, (sd)->words, (out), sizeof(*(out))); \
+    })
+
+#define seq_write(sd, in)                                              \
+    do {                                                               \
+        __seq_data_check(sd, in);                                      \
+        __seq_write(&(sd)->lock, (sd)->words, (in), sizeof(*(in)));   \
+    } while (0)
+
+static inline void __seq_copy_out(atomic_ulong *words, void *out, size_t size)
+{
+    unsigned long w;
+    size_t i;
+
+    for (i = 0; i < size / sizeof(w); i++) {
+        w = atomic_load_explicit(&words[i], memory_order_relaxed);
+        memcpy((char *)out + i * sizeof(w), &w, sizeof(w));
+    }
+    if (size % sizeof(w)) {
+        w = atomic_load_explicit(&words[i], memory_order_relaxed);
+        memcpy((char *)out + i * sizeof(w), &w, size % sizeof(w));
+    }
+}
+
+static inline int __seq_read_copy(seqlock_t *lock, atomic_ulong *words,
+                                  void *out, size_t size)
+{
+    int seq, retry = -1;
+
+    do {
+        retry++;
+        seq = read_seqbegin(lock);
+        __seq_copy_out(words, out, size);
+    } while (read_seqretry(lock, seq));
+
+    return retry;
+}
+
+static inline void __seq_write(seqlock_t *lock, atomic_ulong *words,
+                               const void *in, size_t size)
+{
+    unsigned long w;
+    size_t i;
+
+    write_seqlock(lock);
+
+    for (i = 0; i < size / sizeof(w); i++) {
+        memcpy(&w, (const char *)in + i * sizeof(w), sizeof(w));
+        atomic_store_explicit(&words[i], w, memory_order_relaxed);
+    }
+    if (size % sizeof(w)) {
+        w = 0;
+        memcpy(&w, (const char *)in + i * sizeof(w), size % sizeof(w));
+        atomic_store_explicit(&words[i], w, memory_order_relaxed);
+    }
+
+    write_sequnlock(lock);
 }
 
 #endif /* __SEQLOCK_H__ */
@@ -0,0 +1,138 @@
+/*
+ * sequence lock: A benchmark of the seqlock protected data
+ *
+ * The writer publishes the DATA_SIZE bytes snapshot by seq_write() at the
+ * different intervals, while the readers keep copying it out by
+ * seq_read_copy(). Every snapshot is filled by one sequence number, so the
+ * reader checks it is not torn. It shows how the reader throughput and the
+ * retries change with the write rate.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2021 linD026
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "seqlock.h"
+
+#ifndef DATA_SIZE
+#define DATA_SIZE 128
+#endif
+
+/* The run time of each write interval, in ms */
+#ifndef RUN_MS
+#define RUN_MS 200
+#endif
+
+#define NR_VAL (DATA_SIZE / sizeof(unsigned long))
+
+struct snapshot {
+    unsigned long val[NR_VAL];
+};
+
+static SEQLOCK_DATA(struct snapshot) sd;
+static atomic_int stop;
+static atomic_ulong nr_read, nr_retry, nr_violate;
+
+static void *reader_side(void *argv)
+{
+    struct snapshot s;
+    unsigned long read = 0, retry = 0, bad = 0;
+    size_t i;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        retry += seq_read_copy(&sd, &s);
+        for (i = 1; i < NR_VAL; i++)
+            if (s.val[i] != s.val[0])
+                bad++;
+        read++;
+    }
+
+    atomic_fetch_add(&nr_read, read);
+    atomic_fetch_add(&nr_retry, retry);
+    atomic_fetch_add(&nr_violate, bad);
+
+    pthread_exit(NULL);
+}
+
+static double time_diff(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+           (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Write every interval ns, 0 means writing continuously. */
+static void benchmark(long interval)
+{
+    pthread_t reader[READER_NUM];
+    struct timespec start, now, delay = { 0, interval };
+    struct snapshot s;
+    unsigned long seq = 0;
+    double during;
+    size_t i;
+
+    atomic_store(&stop, 0);
+    atomic_store(&nr_read, 0);
+    atomic_store(&nr_retry, 0);
+
+    for (i = 0; i < READER_NUM; i++)
+        pthread_create(&reader[i], NULL, reader_side, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        seq++;
+        for (i = 0; i < NR_VAL; i++)
+            s.val[i] = seq;
+        seq_write(&sd, &s);
+        if (interval)
+            nanosleep(&delay, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (time_diff(&start, &now) * 1000 < RUN_MS);
+
+    atomic_store(&stop, 1);
+    for (i = 0; i < READER_NUM; i++)
+        pthread_join(reader[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    during = time_diff(&start, &now);
+    printf("interval %8ld ns: %10.0f writes/sec, %12.0f reads/sec, "
+           "%.4f retries/read\n",
+           interval, seq / during, atomic_load(&nr_read) / during,
+           atomic_load(&nr_read) ?
+               (double)atomic_load(&nr_retry) / atomic_load(&nr_read) :
+               0);
+}
+
+int main(int argc, char *argv[])
+{
+    long interval;
+
+    printf("seqlock data: reader %d, %d bytes\n", READER_NUM, DATA_SIZE);
+
+    seq_data_init(&sd);
+
+    for (interval = 1000000; interval >= 10000; interval /= 10)
+        benchmark(interval);
+    benchmark(0);
+
+    if (atomic_load(&nr_violate))
+        printf("%lu violation\n", atomic_load(&nr_violate));
+
+    return atomic_load(&nr_violate) ? 1 : 0;
+}